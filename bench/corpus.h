@@ -0,0 +1,239 @@
+#pragma once
+
+// Generates a synthetic application for the end-to-end benchmarks: an exe and a layered graph of
+// DLLs importing from each other, plus a sysroot with the one system DLL they all import. On Linux,
+// also runs wdeps over it, in the modes shared by wdeps_e2e and wdeps_stress.
+
+#include "pe_image.h"
+#include <fstream>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#endif
+
+struct CorpusSpec {
+    unsigned dlls = 100;
+    // How many DLLs of the next layer every DLL imports
+    unsigned fanOut = 4;
+    // The number of layers the DLLs are spread over
+    unsigned depth = 4;
+    unsigned exports = 32;
+    unsigned relocations = 64;
+    // 1 puts the DLLs next to the exe, more spreads them over that many directories on the search path
+    unsigned directories = 1;
+    // "pe32", "pe64" or "mixed"
+    std::string machine = "mixed";
+    unsigned seed = 1;
+};
+
+struct Corpus {
+    boost::filesystem::path input;
+    boost::filesystem::path sysroot;
+    std::vector<boost::filesystem::path> searchPath;
+};
+
+// Adds the options describing a corpus, shared with wdeps_e2e
+inline void addCorpusOptions(boost::program_options::options_description& description, CorpusSpec& spec) {
+    description.add_options()
+        ("fan-out", boost::program_options::value<unsigned>(&spec.fanOut)->default_value(spec.fanOut)->value_name("N"), "How many DLLs of the next layer every DLL imports.")
+        ("depth", boost::program_options::value<unsigned>(&spec.depth)->default_value(spec.depth)->value_name("N"), "The number of layers of DLLs below the exe.")
+        ("exports", boost::program_options::value<unsigned>(&spec.exports)->default_value(spec.exports)->value_name("N"), "The number of symbols every DLL exports.")
+        ("relocs", boost::program_options::value<unsigned>(&spec.relocations)->default_value(spec.relocations)->value_name("N"), "The number of relocations in every DLL.")
+        ("directories", boost::program_options::value<unsigned>(&spec.directories)->default_value(spec.directories)->value_name("N"), "1 puts the DLLs next to the exe, more spreads them over that many directories on the search path.")
+        ("machine", boost::program_options::value<std::string>(&spec.machine)->default_value(spec.machine)->value_name("type"), "\"pe32\", \"pe64\" or \"mixed\".")
+        ("seed", boost::program_options::value<unsigned>(&spec.seed)->default_value(spec.seed)->value_name("N"), "Seed for the edges and symbols picked at random.");
+}
+
+inline void writeImage(const boost::filesystem::path& file, const ImageSpec& spec) {
+    auto image = buildImage(spec);
+    std::ofstream out(file.string(), std::ios::binary);
+    out.write(reinterpret_cast<const char*>(image.data()), image.size());
+    if (!out) {
+        throw std::runtime_error("Unable to write " + file.string());
+    }
+}
+
+inline Corpus generateCorpus(const CorpusSpec& spec, const boost::filesystem::path& directory) {
+    namespace fs = boost::filesystem;
+    if (spec.depth == 0 || spec.directories == 0 || spec.dlls < spec.depth) {
+        throw std::runtime_error("A corpus needs at least one directory, one layer and one DLL per layer");
+    }
+    if (spec.machine != "pe32" && spec.machine != "pe64" && spec.machine != "mixed") {
+        throw std::runtime_error("Unknown machine " + spec.machine);
+    }
+    Corpus corpus;
+    auto app = directory / "app";
+    corpus.input = app / "app.exe";
+    corpus.sysroot = directory / "sysroot";
+    auto system32 = corpus.sysroot / "windows" / "system32";
+    fs::create_directories(app);
+    fs::create_directories(system32);
+    for (unsigned i = 0; spec.directories > 1 && i < spec.directories; i++) {
+        corpus.searchPath.push_back(directory / ("lib" + std::to_string(i)));
+        fs::create_directories(corpus.searchPath.back());
+    }
+
+    std::vector<std::string> exports;
+    for (unsigned i = 0; i < spec.exports; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Func%05u", i);
+        exports.push_back(name);
+    }
+    std::mt19937 random(spec.seed);
+    // A few of the symbols every DLL exports, picked at random
+    auto symbols = [&]() {
+        std::set<std::string> picked;
+        for (unsigned i = 0; i < std::min(4u, spec.exports); i++) {
+            picked.insert(exports[random() % exports.size()]);
+        }
+        return std::vector<std::string>(picked.begin(), picked.end());
+    };
+    auto dllName = [](unsigned i) {
+        char name[32];
+        snprintf(name, sizeof(name), "dll%05u.dll", i);
+        return std::string(name);
+    };
+
+    // Layer l holds the DLLs [layers[l], layers[l + 1])
+    std::vector<unsigned> layers;
+    for (unsigned l = 0; l <= spec.depth; l++) {
+        layers.push_back(unsigned(std::uint64_t(spec.dlls) * l / spec.depth));
+    }
+
+    ImageSpec kernel32;
+    kernel32.name = "kernel32.dll";
+    kernel32.exports = { "ExitProcess" };
+    writeImage(system32 / kernel32.name, kernel32);
+
+    ImageSpec exe;
+    exe.dll = false;
+    exe.pe64 = spec.machine != "pe32";
+    for (unsigned i = layers[0]; i < layers[1]; i++) {
+        exe.imports.emplace_back(dllName(i), symbols());
+    }
+    exe.imports.emplace_back("kernel32.dll", std::vector<std::string>{ "ExitProcess" });
+    writeImage(corpus.input, exe);
+
+    for (unsigned l = 0; l < spec.depth; l++) {
+        for (unsigned i = layers[l]; i < layers[l + 1]; i++) {
+            ImageSpec dll;
+            dll.name = dllName(i);
+            dll.pe64 = spec.machine == "pe64" || (spec.machine == "mixed" && i % 2);
+            dll.exports = exports;
+            dll.relocations = spec.relocations;
+            if (l + 1 < spec.depth) {
+                // Every DLL of the next layer has at least one importer, the rest of the edges are random
+                std::set<unsigned> children;
+                unsigned parents = layers[l + 1] - layers[l], next = layers[l + 2] - layers[l + 1];
+                for (unsigned j = i - layers[l]; j < next; j += parents) {
+                    children.insert(layers[l + 1] + j);
+                }
+                while (children.size() < std::min(spec.fanOut, next)) {
+                    children.insert(layers[l + 1] + random() % next);
+                }
+                for (auto child : children) {
+                    dll.imports.emplace_back(dllName(child), symbols());
+                }
+            }
+            dll.imports.emplace_back("kernel32.dll", std::vector<std::string>{ "ExitProcess" });
+            auto& home = spec.directories > 1 ? corpus.searchPath[i % spec.directories] : app;
+            writeImage(home / dll.name, dll);
+        }
+    }
+    return corpus;
+}
+
+// The wdeps arguments that make it search the corpus
+inline std::vector<std::string> corpusArguments(const Corpus& corpus) {
+    std::vector<std::string> arguments = { "--sysroot", corpus.sysroot.string() };
+    for (auto& path : corpus.searchPath) {
+        arguments.push_back("--search-path");
+        arguments.push_back(path.string());
+    }
+    return arguments;
+}
+
+// A way of running wdeps over a corpus, every one runs fillDependencies over the whole corpus, then its own report
+struct Mode {
+    std::string name;
+    std::vector<std::string> arguments;
+    // The output includes times, so it differs from run to run
+    bool timed = false;
+    // Copies the dependencies, into a directory of its own
+    bool copies = false;
+};
+
+const std::vector<Mode> modes = {
+    { "list", {} },
+    { "tree", { "--tree", "--system", "--path" } },
+    { "startup", { "--startup", "--tree" } },
+    { "rebase", { "--rebase" } },
+    { "usage", { "--usage" } },
+    { "unresolved", { "--unresolved" } },
+    { "ndjson", { "--format", "ndjson" } },
+    { "probes", { "--probes" }, true },
+    { "copy", { "--force" }, true, true },
+};
+
+// The mode's own arguments, `scratch` is where it may write files
+inline std::vector<std::string> modeArguments(const Mode& mode, const boost::filesystem::path& scratch) {
+    auto arguments = mode.arguments;
+    if (mode.copies) {
+        arguments.push_back("--copy");
+        arguments.push_back((scratch / ("copy-" + mode.name)).string());
+    }
+    return arguments;
+}
+
+#ifdef __linux__
+// Starts the command with its standard output written to `output` and its errors discarded, stopped
+// before exec when it's going to be traced
+inline pid_t spawn(const std::vector<std::string>& command, const std::string& output = "/dev/null", bool traced = false) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        throw std::runtime_error("Unable to start " + command[0] + ": " + strerror(errno));
+    }
+    if (pid == 0) {
+        int out = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(out, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        if (traced) {
+            ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+            raise(SIGSTOP);
+        }
+        std::vector<char*> argv;
+        for (auto& arg : command) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+inline void checkStatus(const std::vector<std::string>& command, int status) {
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error(command[0] + " failed with status " + std::to_string(status));
+    }
+}
+
+// Runs the command to the end, throws if it fails
+inline void run(const std::vector<std::string>& command, const std::string& output = "/dev/null") {
+    pid_t pid = spawn(command, output);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    checkStatus(command, status);
+}
+#endif
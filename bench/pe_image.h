@@ -0,0 +1,239 @@
+#pragma once
+
+// Writes minimal PE32 and PE32+ images for the benchmarks: one data section with the import and
+// export tables and a .reloc section, behind a configurable number of empty sections.
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+struct ImageSpec {
+    bool pe64 = true;
+    bool dll = true;
+    // 0 for the usual default of the machine
+    std::uint64_t imageBase = 0;
+    // The name in the export directory
+    std::string name;
+    // Module name -> imported symbol names
+    std::vector<std::pair<std::string, std::vector<std::string>>> imports;
+    // Sorted, like the loader expects the name table to be
+    std::vector<std::string> exports;
+    unsigned relocations = 0;
+    // Empty sections in front of the data section
+    unsigned paddingSections = 0;
+};
+
+const std::uint32_t imageFileAlignment = 0x200;
+const std::uint32_t imageSectionAlignment = 0x1000;
+
+inline std::uint64_t defaultImageBase(const ImageSpec& spec) {
+    return spec.pe64 ? 0x180000000 : 0x10000000;
+}
+
+// Appends the little-endian pieces of a section, addressed by their RVAs
+class SectionWriter {
+public:
+    explicit SectionWriter(std::uint32_t base) : base(base) { }
+
+    std::uint32_t rva() const { return base + std::uint32_t(data.size()); }
+
+    std::uint32_t put(std::uint64_t value, int bytes) {
+        auto at = rva();
+        for (int i = 0; i < bytes; i++) {
+            data.push_back(std::uint8_t(value >> (8 * i)));
+        }
+        return at;
+    }
+
+    std::uint32_t putString(const std::string& s) {
+        auto at = rva();
+        data.insert(data.end(), s.begin(), s.end());
+        data.push_back(0);
+        return at;
+    }
+
+    void patch(std::uint32_t at, std::uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            data[at - base + i] = std::uint8_t(value >> (8 * i));
+        }
+    }
+
+    void align(std::size_t alignment) {
+        data.resize((data.size() + alignment - 1) / alignment * alignment);
+    }
+
+    std::uint32_t base;
+    std::vector<std::uint8_t> data;
+};
+
+inline void putField(std::vector<std::uint8_t>& image, std::size_t offset, std::uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        image[offset + i] = std::uint8_t(value >> (8 * i));
+    }
+}
+
+inline std::vector<std::uint8_t> buildImage(const ImageSpec& spec) {
+    const int pointerSize = spec.pe64 ? 8 : 4;
+    SectionWriter s(imageSectionAlignment * (spec.paddingSections + 1));
+
+    struct Descriptor {
+        std::uint32_t lookup, name, addresses;
+    };
+    std::vector<Descriptor> descriptors;
+    for (auto& module : spec.imports) {
+        auto name = s.putString(module.first);
+        std::vector<std::uint32_t> hintNames;
+        for (std::size_t i = 0; i < module.second.size(); i++) {
+            s.align(2);
+            hintNames.push_back(s.put(i, 2));
+            s.putString(module.second[i]);
+        }
+        s.align(pointerSize);
+        std::uint32_t thunks[2];
+        for (auto& table : thunks) {
+            table = s.rva();
+            for (auto hintName : hintNames) {
+                s.put(hintName, pointerSize);
+            }
+            s.put(0, pointerSize);
+        }
+        descriptors.push_back({ thunks[0], name, thunks[1] });
+    }
+    s.align(4);
+    std::uint32_t importRVA = s.rva();
+    for (auto& d : descriptors) {
+        s.put(d.lookup, 4);
+        s.put(0, 8);
+        s.put(d.name, 4);
+        s.put(d.addresses, 4);
+    }
+    s.put(0, 20);
+    std::uint32_t importSize = spec.imports.empty() ? 0 : s.rva() - importRVA;
+
+    std::uint32_t exportRVA = 0, exportSize = 0;
+    if (!spec.exports.empty()) {
+        auto count = std::uint32_t(spec.exports.size());
+        s.align(4);
+        exportRVA = s.rva();
+        s.put(0, 40);
+        std::uint32_t functions = s.rva();
+        for (std::uint32_t i = 0; i < count; i++) {
+            s.put(imageSectionAlignment, 4);
+        }
+        std::uint32_t names = s.rva();
+        s.put(0, 4 * count);
+        std::uint32_t ordinals = s.rva();
+        for (std::uint32_t i = 0; i < count; i++) {
+            s.put(i, 2);
+        }
+        std::uint32_t dllName = s.putString(spec.name);
+        for (std::uint32_t i = 0; i < count; i++) {
+            s.patch(names + 4 * i, s.putString(spec.exports[i]), 4);
+        }
+        s.patch(exportRVA + 12, dllName, 4);
+        s.patch(exportRVA + 16, 1, 4);
+        s.patch(exportRVA + 20, count, 4);
+        s.patch(exportRVA + 24, count, 4);
+        s.patch(exportRVA + 28, functions, 4);
+        s.patch(exportRVA + 32, names, 4);
+        s.patch(exportRVA + 36, ordinals, 4);
+        exportSize = s.rva() - exportRVA;
+    }
+
+    s.align(imageFileAlignment);
+
+    // Blocks of up to 256 entries in a section of their own, like linkers do, a block with an odd
+    // count is padded with an absolute entry
+    SectionWriter r(s.base + std::uint32_t((s.data.size() + imageSectionAlignment - 1) / imageSectionAlignment * imageSectionAlignment));
+    for (unsigned done = 0, page = 0; done < spec.relocations; page++) {
+        unsigned count = std::min(spec.relocations - done, 256u);
+        r.put(imageSectionAlignment * page, 4);
+        r.put(8 + 2 * (count + count % 2), 4);
+        for (unsigned i = 0; i < count; i++) {
+            // IMAGE_REL_BASED_DIR64 or IMAGE_REL_BASED_HIGHLOW
+            r.put(((spec.pe64 ? 10 : 3) << 12) | (i * pointerSize % imageSectionAlignment), 2);
+        }
+        if (count % 2) {
+            r.put(0, 2);
+        }
+        done += count;
+    }
+    std::uint32_t relocSize = std::uint32_t(r.data.size());
+    r.align(imageFileAlignment);
+
+    struct Section {
+        std::string name;
+        std::uint32_t rva;
+        std::vector<std::uint8_t> data;
+    };
+    std::vector<Section> sections;
+    for (unsigned i = 0; i < spec.paddingSections; i++) {
+        sections.push_back({ ".pad" + std::to_string(i), imageSectionAlignment * (i + 1), std::vector<std::uint8_t>(imageFileAlignment) });
+    }
+    sections.push_back({ ".rdata", s.base, std::move(s.data) });
+    if (relocSize) {
+        sections.push_back({ ".reloc", r.base, std::move(r.data) });
+    }
+    auto& last = sections.back();
+
+    const std::size_t peHeader = 0x80, optionalHeader = peHeader + 24;
+    const std::size_t optionalSize = spec.pe64 ? 240 : 224, sectionTable = optionalHeader + optionalSize;
+    std::size_t headersSize = (sectionTable + 40 * sections.size() + imageFileAlignment - 1) / imageFileAlignment * imageFileAlignment;
+    std::size_t imageSize = headersSize;
+    for (auto& section : sections) {
+        imageSize += section.data.size();
+    }
+    std::vector<std::uint8_t> image(imageSize);
+
+    putField(image, 0, 0x5A4D, 2);
+    putField(image, 0x3C, peHeader, 4);
+    putField(image, peHeader, 0x4550, 4);
+    putField(image, peHeader + 4, spec.pe64 ? 0x8664 : 0x14C, 2);
+    putField(image, peHeader + 6, sections.size(), 2);
+    putField(image, peHeader + 20, optionalSize, 2);
+    putField(image, peHeader + 22, (spec.dll ? 0x2000 : 0) | (spec.pe64 ? 0x22 : 0x102), 2);
+
+    auto imageBase = spec.imageBase ? spec.imageBase : defaultImageBase(spec);
+    putField(image, optionalHeader, spec.pe64 ? 0x20B : 0x10B, 2);
+    putField(image, optionalHeader + 20, imageSectionAlignment, 4);
+    if (spec.pe64) {
+        putField(image, optionalHeader + 24, imageBase, 8);
+    }else{
+        putField(image, optionalHeader + 28, imageBase, 4);
+    }
+    putField(image, optionalHeader + 32, imageSectionAlignment, 4);
+    putField(image, optionalHeader + 36, imageFileAlignment, 4);
+    putField(image, optionalHeader + 40, 6, 2);
+    putField(image, optionalHeader + 48, 6, 2);
+    putField(image, optionalHeader + 56, last.rva + (last.data.size() + imageSectionAlignment - 1) / imageSectionAlignment * imageSectionAlignment, 4);
+    putField(image, optionalHeader + 60, headersSize, 4);
+    putField(image, optionalHeader + 68, 3, 2);
+    putField(image, optionalHeader + 70, 0x140, 2);
+    std::size_t directories = optionalHeader + (spec.pe64 ? 112 : 96);
+    putField(image, directories - 4, 16, 4);
+    auto directory = [&](int index, std::uint32_t rva, std::uint32_t size) {
+        putField(image, directories + 8 * index, size ? rva : 0, 4);
+        putField(image, directories + 8 * index + 4, size, 4);
+    };
+    directory(0, exportRVA, exportSize);
+    directory(1, importRVA, importSize);
+    directory(5, r.base, relocSize);
+
+    std::size_t offset = headersSize;
+    for (std::size_t i = 0; i < sections.size(); i++) {
+        auto& section = sections[i];
+        std::size_t header = sectionTable + 40 * i;
+        std::copy(section.name.begin(), section.name.begin() + std::min<std::size_t>(section.name.size(), 8), image.begin() + header);
+        putField(image, header + 8, section.data.size(), 4);
+        putField(image, header + 12, section.rva, 4);
+        putField(image, header + 16, section.data.size(), 4);
+        putField(image, header + 20, offset, 4);
+        putField(image, header + 36, 0x40000040, 4);
+        std::copy(section.data.begin(), section.data.end(), image.begin() + offset);
+        offset += section.data.size();
+    }
+    return image;
+}
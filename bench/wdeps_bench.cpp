@@ -0,0 +1,341 @@
+#include "../pe-parse/parse.h"
+#include "pe_image.h"
+#include "../counting_new.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#ifdef __linux__
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace peparse;
+using namespace std;
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+// Every allocation made through operator new, so the benchmarks can report allocations per operation
+atomic<uint64_t> allocations{ 0 };
+
+void countAllocation() noexcept {
+    allocations.fetch_add(1, memory_order_relaxed);
+}
+
+// Keeps the compiler from dropping the work whose result nobody looks at
+volatile uint64_t sink;
+
+const unsigned symbolsPerModule = 16;
+
+// The number of padding sections in front of the data section, so that section lookups get slower
+// with the size too
+unsigned paddingSections(unsigned scale) {
+    return scale / 4 + 1;
+}
+
+// A PE32+ DLL importing 16 symbols from each of `scale` modules, exporting 16 * `scale` names and
+// with 4 * `scale` pages of relocations
+vector<uint8_t> buildImage(unsigned scale) {
+    ImageSpec spec;
+    spec.name = "bench.dll";
+    for (unsigned i = 0; i < scale; i++) {
+        vector<string> symbols;
+        for (unsigned j = 0; j < symbolsPerModule; j++) {
+            symbols.push_back("Symbol" + to_string(i) + "_" + to_string(j));
+        }
+        spec.imports.emplace_back("bench" + to_string(i) + ".dll", move(symbols));
+    }
+    for (unsigned i = 0; i < symbolsPerModule * scale; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Export%06u", i);
+        spec.exports.push_back(name);
+    }
+    spec.relocations = 4 * scale * 256;
+    spec.paddingSections = paddingSections(scale);
+    return buildImage(spec);
+}
+
+struct Result {
+    string name;
+    double nsPerOp;
+    double allocsPerOp;
+};
+
+// Runs op(iterations) with more and more iterations, until one run takes at least minTime
+template<class F>
+Result measure(const string& name, chrono::nanoseconds minTime, F&& op) {
+    sink = sink + op(1);
+    uint64_t iterations = 1;
+    while (true) {
+        auto allocationsBefore = allocations.load();
+        auto start = chrono::steady_clock::now();
+        sink = sink + op(iterations);
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        auto allocated = allocations.load() - allocationsBefore;
+        if (elapsed >= minTime) {
+            return { name, double(elapsed.count()) / iterations, double(allocated) / iterations };
+        }
+        auto scaled = elapsed.count() > 0 ? uint64_t(iterations * 1.2 * minTime.count() / elapsed.count()) : iterations * 100;
+        iterations = max(iterations + 1, min(scaled, iterations * 100));
+    }
+}
+
+#ifdef __linux__
+// How much one parse with every stage raises the peak RSS, in kilobytes. Measured in a forked child,
+// whose peak starts at its current RSS rather than at the peak of this process, which the other
+// benchmarks already raised. The free heap pages they left behind are given back first, so that the
+// parse has to touch new ones.
+long parsePeakRssKb(const string& file) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+#ifdef __GLIBC__
+        malloc_trim(0);
+#endif
+        rusage before{}, after{};
+        getrusage(RUSAGE_SELF, &before);
+        auto parsed = ParsePE(file.c_str(), PARSE_ALL);
+        getrusage(RUSAGE_SELF, &after);
+        long peak = parsed.pe ? after.ru_maxrss - before.ru_maxrss : -1;
+        ssize_t written = write(fds[1], &peak, sizeof(peak));
+        _exit(written == sizeof(peak) ? 0 : 1);
+    }
+    close(fds[1]);
+    long peak = -1;
+    if (pid < 0 || read(fds[0], &peak, sizeof(peak)) != sizeof(peak)) {
+        peak = -1;
+    }
+    close(fds[0]);
+    if (pid > 0) {
+        waitpid(pid, nullptr, 0);
+    }
+    return peak;
+}
+#endif
+
+// "name ns_per_op allocs_per_op" lines, as written by --output
+map<string, Result> readResults(const string& file) {
+    ifstream in(file);
+    if (!in) {
+        throw runtime_error("Unable to read " + file);
+    }
+    map<string, Result> results;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        istringstream fields(line);
+        Result result;
+        if (!(fields >> result.name >> result.nsPerOp >> result.allocsPerOp)) {
+            throw runtime_error("Malformed line in " + file + ": " + line);
+        }
+        results[result.name] = result;
+    }
+    return results;
+}
+
+int main(int argc, char** argv) {
+    po::options_description description("Options");
+    description.add_options()
+        ("min-time", po::value<unsigned>()->default_value(200)->value_name("ms"), "Run every benchmark for at least this long.")
+        ("filter", po::value<string>()->value_name("text"), "Only run the benchmarks whose name contains the text.")
+        ("output", po::value<string>()->value_name("file"), "Also write the results to the file, for use with --baseline.")
+        ("baseline", po::value<string>()->value_name("file"), "Compare the results with the ones saved with --output.")
+        ("max-regression", po::value<double>()->value_name("percent"), "When used with --baseline, exit with 1 if a benchmark got slower by more than this, or allocates more.")
+        ("help", "Print this help message.");
+
+    po::variables_map varMap;
+    try {
+        po::store(po::parse_command_line(argc, argv, description), varMap);
+        po::notify(varMap);
+    }catch(exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (varMap.count("help")) {
+        cout << "Usage: wdeps_bench [options]\n\n" << description << '\n';
+        return 0;
+    }
+
+    map<string, Result> baseline;
+    if (varMap.count("baseline")) {
+        try {
+            baseline = readResults(varMap["baseline"].as<string>());
+        }catch(exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+    }
+
+    auto directory = fs::temp_directory_path() / fs::unique_path("wdeps-bench-%%%%%%%%");
+    fs::create_directories(directory);
+    vector<pair<string, unsigned>> sizes = { { "small", 4 }, { "medium", 32 }, { "large", 256 } };
+    map<string, string> files;
+    for (auto& size : sizes) {
+        auto image = buildImage(size.second);
+        auto file = (directory / (size.first + ".dll")).string();
+        ofstream(file, ios::binary).write(reinterpret_cast<const char*>(image.data()), image.size());
+        files[size.first] = file;
+
+        auto parsed = ParsePE(file.c_str());
+        if (!parsed.pe || GetImports(parsed.pe.get()).size() != size.second * symbolsPerModule || GetExports(parsed.pe.get()).size() != size.second * symbolsPerModule) {
+            cerr << "The generated " << size.first << " image doesn't parse as expected: " << GetPEErrString(parsed.error) << endl;
+            fs::remove_all(directory);
+            return 1;
+        }
+    }
+
+    chrono::nanoseconds minTime = chrono::milliseconds(varMap["min-time"].as<unsigned>());
+    string filter = varMap.count("filter") ? varMap["filter"].as<string>() : "";
+    vector<Result> results;
+    auto run = [&](const string& name, auto&& op) {
+        if (name.find(filter) == string::npos) {
+            return;
+        }
+        results.push_back(measure(name, minTime, op));
+        auto& result = results.back();
+        cout << result.name << '\t' << result.nsPerOp << '\t' << result.allocsPerOp;
+        auto it = baseline.find(result.name);
+        if (it != baseline.end()) {
+            cout << "\t(" << showpos << (result.nsPerOp / it->second.nsPerOp - 1) * 100 << "% time, " << result.allocsPerOp - it->second.allocsPerOp << " allocs)" << noshowpos;
+        }
+        cout << endl;
+    };
+    cout << "# benchmark\tns/op\tallocs/op\n";
+
+    {
+        auto* buffer = readFileToFileBuffer(files["large"].c_str());
+        uint32_t length = uint32_t(bufLen(buffer)) & ~7u;
+        run("readDword", [&](uint64_t iterations) {
+            uint64_t sum = 0;
+            for (uint32_t i = 0, offset = 0; i < iterations; i++, offset = (offset + 4) % length) {
+                uint32_t value = 0;
+                readDword(buffer, offset, value);
+                sum += value;
+            }
+            return sum;
+        });
+        run("readQword", [&](uint64_t iterations) {
+            uint64_t sum = 0;
+            for (uint32_t i = 0, offset = 0; i < iterations; i++, offset = (offset + 8) % length) {
+                uint64_t value = 0;
+                readQword(buffer, offset, value);
+                sum += value;
+            }
+            return sum;
+        });
+        deleteBuffer(buffer);
+    }
+
+    for (auto& size : sizes) {
+        auto& file = files[size.first];
+        auto parsed = ParsePE(file.c_str(), PARSE_EXPORTS);
+        auto* pe = parsed.pe.get();
+
+        // ReadByteAtVA finds the section with getSecForVA, every section is visited in turn
+        vector<VA> addresses;
+        for (unsigned i = 0; i <= paddingSections(size.second); i++) {
+            addresses.push_back(0x180000000 + imageSectionAlignment * (i + 1) + 16);
+        }
+        run("getSecForVA/" + size.first, [&](uint64_t iterations) {
+            uint64_t sum = 0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                uint8_t value = 0;
+                ReadByteAtVA(pe, addresses[i % addresses.size()], value);
+                sum += value;
+            }
+            return sum;
+        });
+
+        // Binary search of the name table, comparing its C strings in place
+        auto exports = GetExports(pe);
+        vector<string> names;
+        for (size_t i = 0; i < exports.size(); i += 7) {
+            export_ref entry;
+            exports.at(i, entry);
+            names.emplace_back(entry.name);
+        }
+        run("exportFind/" + size.first, [&](uint64_t iterations) {
+            uint64_t sum = 0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                export_ref entry;
+                sum += exports.find(names[i % names.size()], entry) ? entry.ordinal : 0;
+            }
+            return sum;
+        });
+
+        // Every stage on its own, "headers" is the part all of them share
+        pair<const char*, uint32_t> stages[] = {
+            { "headers", 0 },
+            { "getImports", PARSE_IMPORTS },
+            { "getExportTable", PARSE_EXPORTS },
+            { "getRelocations", PARSE_RELOCATIONS },
+            { "ParsePEFromFile", PARSE_ALL },
+        };
+        for (auto& stage : stages) {
+            run(string(stage.first) + "/" + size.first, [&](uint64_t iterations) {
+                uint64_t sum = 0;
+                for (uint64_t i = 0; i < iterations; i++) {
+                    sum += ParsePE(file.c_str(), stage.second).pe != nullptr;
+                }
+                return sum;
+            });
+        }
+    }
+
+#ifdef __linux__
+    // Not part of --output and --baseline. Small images fit into pages that are already resident and show 0.
+    bool printedHeader = false;
+    for (auto& size : sizes) {
+        auto name = "peakRss/" + size.first;
+        if (name.find(filter) == string::npos) {
+            continue;
+        }
+        if (!printedHeader) {
+            cout << "# benchmark\tpeak RSS kB of one ParsePEFromFile\n";
+            printedHeader = true;
+        }
+        cout << name << '\t' << parsePeakRssKb(files[size.first]) << endl;
+    }
+#endif
+    fs::remove_all(directory);
+
+    if (varMap.count("output")) {
+        ofstream out(varMap["output"].as<string>());
+        out << "# benchmark\tns/op\tallocs/op\n";
+        for (auto& result : results) {
+            out << result.name << '\t' << result.nsPerOp << '\t' << result.allocsPerOp << '\n';
+        }
+        if (!out) {
+            cerr << "Unable to write " << varMap["output"].as<string>() << endl;
+            return 1;
+        }
+    }
+
+    if (varMap.count("baseline") && varMap.count("max-regression")) {
+        double limit = varMap["max-regression"].as<double>();
+        bool regressed = false;
+        for (auto& result : results) {
+            auto it = baseline.find(result.name);
+            if (it != baseline.end() && ((result.nsPerOp / it->second.nsPerOp - 1) * 100 > limit || result.allocsPerOp > it->second.allocsPerOp)) {
+                cerr << result.name << " regressed" << endl;
+                regressed = true;
+            }
+        }
+        return regressed ? 1 : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include "corpus.h"
+#include <iostream>
+
+using namespace std;
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+int main(int argc, char** argv) {
+    CorpusSpec spec;
+    po::options_description description("Options");
+    description.add_options()
+        ("dlls", po::value<unsigned>(&spec.dlls)->default_value(spec.dlls)->value_name("N"), "The number of DLLs.");
+    addCorpusOptions(description, spec);
+    description.add_options()
+        ("help", "Print this help message.")
+        ("output", po::value<string>()->value_name("dir"), "The directory to write the corpus to.");
+    po::positional_options_description pos;
+    pos.add("output", 1);
+
+    po::variables_map varMap;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(description).positional(pos).run(), varMap);
+        po::notify(varMap);
+    }catch(exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (varMap.count("help") || !varMap.count("output")) {
+        cout << "Usage: wdeps_corpus [options] <dir>\n\n" << description << '\n';
+        return 0;
+    }
+
+    try {
+        auto corpus = generateCorpus(spec, varMap["output"].as<string>());
+        cout << "wdeps --sysroot " << corpus.sysroot.string();
+        for (auto& directory : corpus.searchPath) {
+            cout << " --search-path " << directory.string();
+        }
+        cout << ' ' << corpus.input.string() << '\n';
+    }catch(exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
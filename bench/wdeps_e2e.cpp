@@ -0,0 +1,175 @@
+#include "corpus.h"
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+#include <sys/resource.h>
+
+using namespace std;
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+struct Measurement {
+    double wallMs = 0;
+    long peakRssKb = 0;
+    uint64_t syscalls = 0;
+};
+
+// Wall time and peak RSS of one run
+Measurement timeRun(const vector<string>& command) {
+    auto start = chrono::steady_clock::now();
+    pid_t pid = spawn(command);
+    int status = 0;
+    rusage usage{};
+    wait4(pid, &status, 0, &usage);
+    Measurement result;
+    result.wallMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    // Kilobytes on Linux
+    result.peakRssKb = usage.ru_maxrss;
+    checkStatus(command, status);
+    return result;
+}
+
+// The number of system calls one run makes, on all of its threads, counted with ptrace
+uint64_t countSyscalls(const vector<string>& command) {
+    pid_t pid = spawn(command, "/dev/null", true);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, pid, nullptr, nullptr);
+    uint64_t syscalls = 0;
+    // Syscall stops come in pairs (entry and exit), except for the calls that never return
+    unordered_map<pid_t, bool> inSyscall;
+    int exitStatus = 0;
+    while (true) {
+        pid_t thread = waitpid(-1, &status, __WALL);
+        if (thread < 0) {
+            break;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (thread == pid) {
+                exitStatus = status;
+            }
+            inSyscall.erase(thread);
+            continue;
+        }
+        int signal = WSTOPSIG(status);
+        int deliver = 0;
+        if (signal == (SIGTRAP | 0x80)) {
+            bool& entering = inSyscall[thread];
+            entering = !entering;
+            syscalls += entering;
+        }else if (signal != SIGTRAP && signal != SIGSTOP) {
+            // SIGTRAP comes with the clone events and SIGSTOP starts the new threads, anything else is the program's
+            deliver = signal;
+        }
+        ptrace(PTRACE_SYSCALL, thread, nullptr, deliver);
+    }
+    checkStatus(command, exitStatus);
+    return syscalls;
+}
+
+vector<unsigned> parseSizes(const string& list) {
+    vector<unsigned> sizes;
+    istringstream in(list);
+    string size;
+    while (getline(in, size, ',')) {
+        sizes.push_back(stoul(size));
+    }
+    return sizes;
+}
+
+int main(int argc, char** argv) {
+    CorpusSpec spec;
+    po::options_description description("Options");
+    description.add_options()
+        ("sizes", po::value<string>()->default_value("10,100,1000,10000")->value_name("list"), "Comma-separated numbers of DLLs, a corpus is generated for each.");
+    addCorpusOptions(description, spec);
+    description.add_options()
+        ("wdeps", po::value<string>()->value_name("file"), "The wdeps binary to run, by default the one next to wdeps_e2e.")
+        ("jobs", po::value<unsigned>()->default_value(1)->value_name("N"), "Passed on to wdeps.")
+        ("runs", po::value<unsigned>()->default_value(3)->value_name("N"), "Time every mode this many times, and keep the fastest run.")
+        ("no-syscalls", po::bool_switch(), "Don't count the system calls, which takes one more (much slower) run under ptrace.")
+        ("work-dir", po::value<string>()->value_name("dir"), "Keep the corpora in this directory instead of a temporary one that is removed afterwards.")
+        ("output", po::value<string>()->value_name("file"), "Also write the results to the file.")
+        ("help", "Print this help message.");
+
+    po::variables_map varMap;
+    try {
+        po::store(po::parse_command_line(argc, argv, description), varMap);
+        po::notify(varMap);
+    }catch(exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (varMap.count("help")) {
+        cout << "Usage: wdeps_e2e [options]\n\n" << description << '\n';
+        return 0;
+    }
+
+    auto wdeps = varMap.count("wdeps") ? fs::path(varMap["wdeps"].as<string>()) : fs::read_symlink("/proc/self/exe").parent_path() / "wdeps";
+    bool keep = varMap.count("work-dir") > 0;
+    auto workDir = keep ? fs::path(varMap["work-dir"].as<string>()) : fs::temp_directory_path() / fs::unique_path("wdeps-e2e-%%%%%%%%");
+    unsigned runs = max(1u, varMap["runs"].as<unsigned>());
+    bool syscalls = !varMap["no-syscalls"].as<bool>();
+
+    ostringstream results;
+    results << "# dlls\tmode\twall_ms\tsyscalls\tpeak_rss_kb\n";
+    cout << results.str() << flush;
+    try {
+        for (auto size : parseSizes(varMap["sizes"].as<string>())) {
+            spec.dlls = size;
+            auto directory = workDir / to_string(size);
+            fs::remove_all(directory);
+            auto corpus = generateCorpus(spec, directory);
+
+            vector<string> base = { wdeps.string(), "--jobs", to_string(varMap["jobs"].as<unsigned>()) };
+            auto corpusArgs = corpusArguments(corpus);
+            base.insert(base.end(), corpusArgs.begin(), corpusArgs.end());
+            for (auto& mode : modes) {
+                auto command = base;
+                auto modeArgs = modeArguments(mode, directory);
+                command.insert(command.end(), modeArgs.begin(), modeArgs.end());
+                command.push_back(corpus.input.string());
+
+                Measurement best;
+                for (unsigned i = 0; i < runs; i++) {
+                    auto run = timeRun(command);
+                    if (i == 0 || run.wallMs < best.wallMs) {
+                        best = run;
+                    }
+                }
+                if (syscalls) {
+                    best.syscalls = countSyscalls(command);
+                }
+                ostringstream line;
+                line << size << '\t' << mode.name << '\t' << best.wallMs << '\t' << best.syscalls << '\t' << best.peakRssKb << '\n';
+                cout << line.str() << flush;
+                results << line.str();
+            }
+            if (!keep) {
+                fs::remove_all(directory);
+            }
+        }
+    }catch(exception& e) {
+        cerr << e.what() << endl;
+        if (!keep) {
+            fs::remove_all(workDir);
+        }
+        return 1;
+    }
+    if (!keep) {
+        fs::remove_all(workDir);
+    }
+
+    if (varMap.count("output")) {
+        ofstream out(varMap["output"].as<string>());
+        out << results.str();
+        if (!out) {
+            cerr << "Unable to write " << varMap["output"].as<string>() << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
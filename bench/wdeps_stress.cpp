@@ -0,0 +1,270 @@
+#include "../pe-parse/parse.h"
+#include "corpus.h"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <map>
+
+using namespace peparse;
+using namespace std;
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+// The ways a DLL of the corpus gets damaged, every corruptEvery-th one gets the next of these
+const vector<string> corruptions = { "empty", "dos-stub", "half", "signature", "garbage-headers", "garbage-data", "reloc-wrap", "bad-delay-imports" };
+
+uint32_t readField(const vector<uint8_t>& image, size_t offset, int bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes && offset + i < image.size(); i++) {
+        value |= uint32_t(image[offset + i]) << (8 * i);
+    }
+    return value;
+}
+
+// The file offset of the entry for the data directory in the optional header
+size_t dataDirectoryEntry(const vector<uint8_t>& image, unsigned index) {
+    size_t optional = readField(image, 0x3c, 4) + 24;
+    bool pe64 = readField(image, optional, 2) == 0x20b;
+    return optional + (pe64 ? 112 : 96) + index * 8;
+}
+
+// The file offset of a data directory, or 0 when there's none
+size_t dataDirectoryOffset(const vector<uint8_t>& image, unsigned index) {
+    size_t pe = readField(image, 0x3c, 4);
+    uint32_t rva = readField(image, dataDirectoryEntry(image, index), 4);
+    size_t sections = pe + 24 + readField(image, pe + 20, 2);
+    for (unsigned i = 0; rva != 0 && i < readField(image, pe + 6, 2); i++) {
+        size_t header = sections + i * 40;
+        uint32_t base = readField(image, header + 12, 4), size = readField(image, header + 16, 4);
+        if (rva >= base && rva < base + size) {
+            return readField(image, header + 20, 4) + (rva - base);
+        }
+    }
+    return 0;
+}
+
+void corrupt(const fs::path& file, const string& how, mt19937& random) {
+    vector<uint8_t> image;
+    {
+        ifstream in(file.string(), ios::binary);
+        image.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    auto scramble = [&](size_t from, size_t to) {
+        for (size_t i = from; i < min(to, image.size()); i++) {
+            image[i] = uint8_t(random());
+        }
+    };
+    if (how == "empty") {
+        image.clear();
+    }else if (how == "dos-stub") {
+        image.resize(min<size_t>(image.size(), 0x40));
+    }else if (how == "half") {
+        image.resize(image.size() / 2);
+    }else if (how == "signature") {
+        uint32_t peOffset = image[0x3c] | image[0x3d] << 8 | image[0x3e] << 16 | uint32_t(image[0x3f]) << 24;
+        scramble(peOffset, peOffset + 4);
+    }else if (how == "garbage-headers") {
+        // Keeps the DOS header, so that the parse gets as far as the NT headers and the section table
+        scramble(0x40, imageFileAlignment);
+    }else if (how == "garbage-data") {
+        // Keeps the headers, so that the stages follow the data directories into the garbage
+        scramble(imageFileAlignment, image.size());
+    }else if (how == "reloc-wrap") {
+        // A 16 byte block, then one whose size takes the offset of the next block past 4 GB and back
+        auto relocations = dataDirectoryOffset(image, 5);
+        if (relocations != 0 && relocations + 24 <= image.size()) {
+            putField(image, relocations + 4, 16, 4);
+            putField(image, relocations + 20, 0xFFFFFFF0, 4);
+        }
+    }else if (how == "bad-delay-imports") {
+        // A delay-load table 8 bytes into the import descriptors: its first entry has no RVA attribute,
+        // so the RVA of the first import's name is taken for a VA and found in no section. The file
+        // stays valid, only without delay-load imports.
+        auto imports = dataDirectoryEntry(image, 1);
+        putField(image, dataDirectoryEntry(image, 13), readField(image, imports, 4) + 8, 4);
+        putField(image, dataDirectoryEntry(image, 13) + 4, 32, 4);
+    }
+    ofstream out(file.string(), ios::binary | ios::trunc);
+    out.write(reinterpret_cast<const char*>(image.data()), image.size());
+    if (!out) {
+        throw runtime_error("Unable to write " + file.string());
+    }
+}
+
+// Everything one parse found out about a file, for comparing the concurrent parses with a serial one
+string summarize(const string& file) {
+    auto parsed = ParsePE(file.c_str(), PARSE_ALL);
+    ostringstream out;
+    if (!parsed.pe) {
+        out << "error " << parsed.error.code << " at " << GetPEErrLoc(parsed.error);
+        return out.str();
+    }
+    auto* pe = parsed.pe.get();
+    unsigned sections = 0, relocations = 0;
+    IterSec(pe, [](void* n, VA, string&, image_section_header, bounded_buffer*) {
+        ++*static_cast<unsigned*>(n);
+        return 0;
+    }, &sections);
+    IterRelocs(pe, [](void* n, VA, reloc_type) {
+        ++*static_cast<unsigned*>(n);
+        return 0;
+    }, &relocations);
+    out << "sections " << sections << " relocations " << relocations << " exports " << GetExports(pe).size() << " imports";
+    for (auto& i : GetImports(pe)) {
+        out << ' ' << i.moduleName << '!' << (i.byOrdinal ? "#" + to_string(i.ordinal) : string(i.symbolName));
+    }
+    out << " delayed";
+    for (auto module : GetDelayImportModules(pe)) {
+        out << ' ' << module;
+    }
+    return out.str();
+}
+
+string readFile(const fs::path& file) {
+    ifstream in(file.string(), ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+int main(int argc, char** argv) {
+    CorpusSpec spec;
+    spec.dlls = 200;
+    po::options_description description("Options");
+    description.add_options()
+        ("dlls", po::value<unsigned>(&spec.dlls)->default_value(spec.dlls)->value_name("N"), "The number of DLLs.");
+    addCorpusOptions(description, spec);
+    description.add_options()
+        ("corrupt-every", po::value<unsigned>()->default_value(5)->value_name("N"), "Damage every N-th DLL of the corpus.")
+        ("jobs", po::value<unsigned>()->default_value(8)->value_name("N"), "The number of threads parsing at once, also passed on to wdeps.")
+        ("rounds", po::value<unsigned>()->default_value(20)->value_name("N"), "How many times every thread parses every file.")
+        ("wdeps", po::value<string>()->value_name("file"), "The wdeps binary to run, by default the one next to wdeps_stress.")
+        ("work-dir", po::value<string>()->value_name("dir"), "Keep the corpus in this directory instead of a temporary one that is removed afterwards.")
+        ("help", "Print this help message.");
+
+    po::variables_map varMap;
+    try {
+        po::store(po::parse_command_line(argc, argv, description), varMap);
+        po::notify(varMap);
+    }catch(exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (varMap.count("help")) {
+        cout << "Usage: wdeps_stress [options]\n\n"
+             << "Parses a corpus with damaged DLLs from many threads at once, and checks that every parse\n"
+             << "gets the same result and error as a serial one. Then checks that wdeps --jobs N reports\n"
+             << "the same as --jobs 1 over it. Most useful in a build with -fsanitize=thread.\n\n"
+             << description << '\n';
+        return 0;
+    }
+
+    auto wdeps = varMap.count("wdeps") ? fs::path(varMap["wdeps"].as<string>()) : fs::read_symlink("/proc/self/exe").parent_path() / "wdeps";
+    bool keep = varMap.count("work-dir") > 0;
+    auto workDir = keep ? fs::path(varMap["work-dir"].as<string>()) : fs::temp_directory_path() / fs::unique_path("wdeps-stress-%%%%%%%%");
+    unsigned jobs = max(1u, varMap["jobs"].as<unsigned>());
+    unsigned rounds = varMap["rounds"].as<unsigned>();
+    unsigned corruptEvery = max(1u, varMap["corrupt-every"].as<unsigned>());
+
+    unsigned failures = 0;
+    try {
+        fs::remove_all(workDir / "corpus");
+        auto corpus = generateCorpus(spec, workDir / "corpus");
+
+        vector<string> files;
+        map<string, unsigned> damaged;
+        mt19937 random(spec.seed);
+        vector<fs::path> directories = corpus.searchPath;
+        directories.push_back(corpus.input.parent_path());
+        for (auto& directory : directories) {
+            for (fs::directory_iterator it(directory), end; it != end; ++it) {
+                files.push_back(it->path().string());
+            }
+        }
+        files.push_back((corpus.sysroot / "windows" / "system32" / "kernel32.dll").string());
+        sort(files.begin(), files.end());
+        unsigned dllIndex = 0, damagedCount = 0;
+        for (auto& file : files) {
+            if (fs::path(file).extension() == ".dll" && file.find("system32") == string::npos && dllIndex++ % corruptEvery == 0) {
+                auto& how = corruptions[damagedCount++ % corruptions.size()];
+                corrupt(file, how, random);
+                damaged[how]++;
+            }
+        }
+
+        vector<string> expected;
+        unsigned invalid = 0;
+        for (auto& file : files) {
+            expected.push_back(summarize(file));
+            invalid += expected.back().compare(0, 6, "error ") == 0;
+        }
+        cout << files.size() << " files, " << invalid << " of them don't parse:";
+        for (auto& entry : damaged) {
+            cout << ' ' << entry.second << ' ' << entry.first;
+        }
+        cout << endl;
+
+        // Every thread starts at a different file, so that each file is parsed by several threads at once
+        atomic<unsigned> mismatches{ 0 };
+        vector<thread> threads;
+        for (unsigned t = 0; t < jobs; t++) {
+            threads.emplace_back([&, t] {
+                for (unsigned round = 0; round < rounds; round++) {
+                    for (size_t i = 0; i < files.size(); i++) {
+                        size_t f = (i + t * files.size() / jobs) % files.size();
+                        if (summarize(files[f]) != expected[f]) {
+                            if (mismatches++ < 10) {
+                                cerr << "Concurrent parse of " << files[f] << " differs from the serial one" << endl;
+                            }
+                        }
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        cout << "parse: " << jobs << " threads x " << rounds << " rounds, " << mismatches << " mismatches" << endl;
+        failures += mismatches;
+
+        // wdeps over the same corpus, with one job and with many, and with a cache shared by both. The
+        // modes whose output has times in it are only checked for finishing.
+        vector<string> base = { wdeps.string() };
+        auto corpusArgs = corpusArguments(corpus);
+        base.insert(base.end(), corpusArgs.begin(), corpusArgs.end());
+        auto cacheDir = workDir / "cache";
+        fs::remove_all(cacheDir);
+        for (auto& mode : modes) {
+            auto output = [&](unsigned jobCount, bool cached) {
+                auto command = base;
+                command.insert(command.end(), { "--jobs", to_string(jobCount) });
+                if (cached) {
+                    command.insert(command.end(), { "--cache-dir", cacheDir.string() });
+                }
+                auto modeArgs = modeArguments(mode, workDir);
+                command.insert(command.end(), modeArgs.begin(), modeArgs.end());
+                command.push_back(corpus.input.string());
+                auto file = workDir / ("out-" + mode.name);
+                run(command, file.string());
+                return readFile(file);
+            };
+            auto serial = output(1, false);
+            // The first cached run fills the cache, the second one reads it
+            auto parallel = output(jobs, false), cold = output(jobs, true), warm = output(jobs, true);
+            if (mode.timed) {
+                cout << "wdeps " << mode.name << ": finished with --jobs " << jobs << endl;
+                continue;
+            }
+            bool same = parallel == serial && cold == serial && warm == serial;
+            cout << "wdeps " << mode.name << ": " << (same ? "same" : "DIFFERENT") << " with --jobs " << jobs << endl;
+            failures += !same;
+        }
+    }catch(exception& e) {
+        cerr << e.what() << endl;
+        failures++;
+    }
+    if (!keep) {
+        fs::remove_all(workDir);
+    }
+    return failures == 0 ? 0 : 1;
+}
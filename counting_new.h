@@ -0,0 +1,42 @@
+#pragma once
+
+// Replaces the global operator new and delete with malloc and free, calling countAllocation() for every
+// allocation. The including program defines countAllocation(). The replacements are definitions,
+// so include this in exactly one translation unit.
+
+#include <cstdlib>
+#include <new>
+
+void countAllocation() noexcept;
+
+void* operator new(std::size_t size) {
+    countAllocation();
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+// GCC pairs the inlined free() with the new-expression rather than with the malloc() above
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#pragma GCC diagnostic pop
@@ -62,8 +62,7 @@ using namespace std;
 
 namespace peparse {
 
-extern ::uint32_t err;
-extern ::string err_loc;
+extern thread_local pe_error err;
 
 struct buffer_detail {
 #ifdef WIN32
@@ -147,6 +146,7 @@ bool readQword(bounded_buffer *b, ::uint32_t offset, ::uint64_t &out) {
 }
 
 bounded_buffer *readFileToFileBuffer(const char *filePath) {
+  PE_STAGE("readFileToFileBuffer");
 #ifdef WIN32
   HANDLE h = CreateFileA(filePath,
                          GENERIC_READ,
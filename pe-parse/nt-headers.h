@@ -374,6 +374,21 @@ struct import_dir_entry {
   std::uint32_t AddressRVA;
 };
 
+// the delay-load descriptor, the fields are RVAs when Attributes has
+// DELAY_IMPORT_ATTR_RVA set and VAs otherwise
+struct delay_import_dir_entry {
+  std::uint32_t Attributes;
+  std::uint32_t NameRVA;
+  std::uint32_t ModuleHandleRVA;
+  std::uint32_t AddressRVA;
+  std::uint32_t NameTableRVA;
+  std::uint32_t BoundAddressRVA;
+  std::uint32_t UnloadAddressRVA;
+  std::uint32_t TimeStamp;
+};
+
+constexpr std::uint32_t DELAY_IMPORT_ATTR_RVA = 0x1;
+
 struct export_dir_table {
   std::uint32_t ExportFlags;
   std::uint32_t TimeDateStamp;
@@ -26,7 +26,7 @@ THE SOFTWARE.
 #include "nt-headers.h"
 #include "to_string.h"
 #include <algorithm>
-#include <list>
+#include <vector>
 #include <stdexcept>
 #include <string.h>
 
@@ -41,16 +41,24 @@ struct section {
   image_section_header sec;
 };
 
-struct importent {
-  VA addr;
-  string symbolName;
-  string moduleName;
-};
-
-struct exportent {
-  VA addr;
-  string symbolName;
-  string moduleName;
+// where the export tables are, so that single exports can be looked up
+// without reading all of them
+struct export_table {
+  bool present = false;
+  VA imageBase = 0;
+  // the export directory, forwarder strings point into it
+  ::uint32_t dirRVA = 0;
+  ::uint32_t dirSize = 0;
+  ::uint32_t nameRVA = 0;
+  ::uint32_t ordinalBase = 0;
+  ::uint32_t numFunctions = 0;
+  ::uint32_t numNames = 0;
+  const section *namesSec = nullptr;
+  ::uint32_t namesOff = 0;
+  const section *ordinalSec = nullptr;
+  ::uint32_t ordinalOff = 0;
+  const section *eatSec = nullptr;
+  ::uint32_t eatOff = 0;
 };
 
 struct reloc {
@@ -106,24 +114,42 @@ struct symbol {
   uint16_t type;
   uint8_t storageClass;
   uint8_t numberOfAuxSymbols;
-  list<aux_symbol_f1> aux_symbols_f1;
-  list<aux_symbol_f2> aux_symbols_f2;
-  list<aux_symbol_f3> aux_symbols_f3;
-  list<aux_symbol_f4> aux_symbols_f4;
-  list<aux_symbol_f5> aux_symbols_f5;
+  vector<aux_symbol_f1> aux_symbols_f1;
+  vector<aux_symbol_f2> aux_symbols_f2;
+  vector<aux_symbol_f3> aux_symbols_f3;
+  vector<aux_symbol_f4> aux_symbols_f4;
+  vector<aux_symbol_f5> aux_symbols_f5;
+};
+
+// Each table is one contiguous block, reserved up front wherever the number of
+// entries is known before parsing them
+// VA range of a section, secIndex keeps these sorted by low
+struct section_range {
+  ::uint64_t low;
+  ::uint64_t high;
+  const section *sec;
 };
 
 struct parsed_pe_internal {
-  list<section> secs;
-  list<resource> rsrcs;
-  list<importent> imports;
-  list<reloc> relocs;
-  list<exportent> exports;
-  list<symbol> symbols;
+  vector<section> secs;
+  vector<section_range> secIndex;
+  // with overlapping sections, lookups fall back to the first match in the
+  // section table, the same as the loader
+  bool secsOverlap = false;
+  vector<resource> rsrcs;
+  // the names in these point into the mapped file
+  vector<import_ref> imports;
+  vector<std::string_view> importModules;
+  vector<std::string_view> delayImportModules;
+  // why the delay-load table was dropped, the static imports are kept
+  pe_error delayImportError = {PEERR_NONE, nullptr, 0};
+  vector<reloc> relocs;
+  export_table exportTable;
+  vector<symbol> symbols;
 };
 
-::uint32_t err = 0;
-std::string err_loc;
+// the last error raised on this thread, ParsePE hands it out per call
+thread_local pe_error err = {PEERR_NONE, nullptr, 0};
 
 static const char *pe_err_str[] = {"None",
                                    "Out of memory",
@@ -137,51 +163,99 @@ static const char *pe_err_str[] = {"None",
                                    "Bad magic"};
 
 int GetPEErr() {
-  return err;
+  return err.code;
 }
 
 string GetPEErrString() {
-  return pe_err_str[err];
+  return GetPEErrString(err);
 }
 
 string GetPEErrLoc() {
-  return err_loc;
+  return GetPEErrLoc(err);
+}
+
+string GetPEErrString(const pe_error &e) {
+  return pe_err_str[e.code];
 }
 
-static bool
-readCString(const bounded_buffer &buffer, ::uint32_t off, string &result) {
+string GetPEErrLoc(const pe_error &e) {
+  if (e.func == nullptr) {
+    return string();
+  }
+  return string(e.func) + ":" + to_string<::uint32_t>(e.line, dec);
+}
+
+// sorts the sections by VA, after which getSecForVA is a binary search
+void buildSectionIndex(parsed_pe_internal &pint) {
+  pint.secIndex.clear();
+  pint.secIndex.reserve(pint.secs.size());
+  for (const section &s : pint.secs) {
+    pint.secIndex.push_back(
+        {s.sectionBase, s.sectionBase + s.sec.Misc.VirtualSize, &s});
+  }
+  std::stable_sort(pint.secIndex.begin(),
+                   pint.secIndex.end(),
+                   [](const section_range &a, const section_range &b) {
+                     return a.low < b.low;
+                   });
+
+  pint.secsOverlap = false;
+  for (size_t i = 1; i < pint.secIndex.size(); i++) {
+    if (pint.secIndex[i].low < pint.secIndex[i - 1].high) {
+      pint.secsOverlap = true;
+    }
+  }
+}
+
+// reads the NUL-terminated string at off, pointing into the buffer instead of
+// copying it
+static bool readCStringView(const bounded_buffer &buffer,
+                            ::uint32_t off,
+                            std::string_view &result) {
   if (off < buffer.bufLen) {
-    ::uint8_t *p = buffer.buf;
-    ::uint32_t n = buffer.bufLen;
-    ::uint8_t *b = p + off;
-    ::uint8_t *x = std::find(b, p + n, 0);
-    if (x == p + n) {
+    const char *b = reinterpret_cast<const char *>(buffer.buf) + off;
+    const void *x = memchr(b, 0, buffer.bufLen - off);
+    if (x == nullptr) {
       return false;
     }
-    result.insert(result.end(), b, x);
+    result = std::string_view(b, static_cast<const char *>(x) - b);
     return true;
   }
   return false;
 }
 
-bool getSecForVA(list<section> &secs, VA v, section &sec) {
-  for (section s : secs) {
-    ::uint64_t low = s.sectionBase;
-    ::uint64_t high = low + s.sec.Misc.VirtualSize;
-
-    if (v >= low && v < high) {
-      sec = s;
-      return true;
+// finds the section containing v, without copying it
+bool getSecForVA(const parsed_pe_internal *pint, VA v, const section *&sec) {
+  if (pint->secsOverlap) {
+    for (const section &s : pint->secs) {
+      if (v >= s.sectionBase && v < s.sectionBase + s.sec.Misc.VirtualSize) {
+        sec = &s;
+        return true;
+      }
     }
+    return false;
   }
 
-  return false;
+  auto it = std::upper_bound(
+      pint->secIndex.begin(),
+      pint->secIndex.end(),
+      v,
+      [](VA va, const section_range &r) { return va < r.low; });
+  if (it == pint->secIndex.begin()) {
+    return false;
+  }
+  --it;
+  if (v >= it->high) {
+    return false;
+  }
+  sec = it->sec;
+  return true;
 }
 
 void IterRsrc(parsed_pe *pe, iterRsrc cb, void *cbd) {
   parsed_pe_internal *pint = pe->internal;
 
-  for (resource r : pint->rsrcs) {
+  for (const resource &r : pint->rsrcs) {
     if (cb(cbd, r) != 0) {
       break;
     }
@@ -212,7 +286,7 @@ bool parse_resource_table(bounded_buffer *sectionData,
                           ::uint32_t virtaddr,
                           ::uint32_t depth,
                           resource_dir_entry *dirent,
-                          list<resource> &rsrcs) {
+                          vector<resource> &rsrcs) {
   ::uint32_t i = 0;
   resource_dir_table rdt;
 
@@ -416,13 +490,14 @@ bool parse_resource_table(bounded_buffer *sectionData,
 
 bool getResources(bounded_buffer *b,
                   bounded_buffer *fileBegin,
-                  list<section> secs,
-                  list<resource> &rsrcs) {
+                  const vector<section> &secs,
+                  vector<resource> &rsrcs) {
+  PE_STAGE("getResources");
 
   if (b == nullptr)
     return false;
 
-  for (section s : secs) {
+  for (const section &s : secs) {
     if (s.sectionName != ".rsrc") {
       continue;
     }
@@ -441,11 +516,14 @@ bool getResources(bounded_buffer *b,
 bool getSections(bounded_buffer *b,
                  bounded_buffer *fileBegin,
                  nt_header_32 &nthdr,
-                 list<section> &secs) {
+                 vector<section> &secs) {
+  PE_STAGE("getSections");
   if (b == nullptr) {
     return false;
   }
 
+  secs.reserve(nthdr.FileHeader.NumberOfSections);
+
   // get each of the sections...
   for (::uint32_t i = 0; i < nthdr.FileHeader.NumberOfSections; i++) {
     image_section_header curSec;
@@ -730,6 +808,7 @@ bool readNtHeader(bounded_buffer *b, nt_header_32 &header) {
 }
 
 bool getHeader(bounded_buffer *file, pe_header &p, bounded_buffer *&rem) {
+  PE_STAGE("getHeader");
   if (file == nullptr) {
     return false;
   }
@@ -791,238 +870,75 @@ bool getHeader(bounded_buffer *file, pe_header &p, bounded_buffer *&rem) {
   return true;
 }
 
-bool getExports(parsed_pe *p) {
+// only finds the export tables, export_view reads the entries when asked
+bool getExportTable(parsed_pe *p) {
+  PE_STAGE("getExportTable");
   data_directory exportDir;
+  export_table &t = p->internal->exportTable;
   if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
     exportDir = p->peHeader.nt.OptionalHeader.DataDirectory[DIR_EXPORT];
+    t.imageBase = p->peHeader.nt.OptionalHeader.ImageBase;
   } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
     exportDir = p->peHeader.nt.OptionalHeader64.DataDirectory[DIR_EXPORT];
+    t.imageBase = p->peHeader.nt.OptionalHeader64.ImageBase;
   } else {
     return false;
   }
 
-  if (exportDir.Size != 0) {
-    section s;
-    VA addr;
-    if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
-      addr = exportDir.VirtualAddress + p->peHeader.nt.OptionalHeader.ImageBase;
-    } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
-      addr =
-          exportDir.VirtualAddress + p->peHeader.nt.OptionalHeader64.ImageBase;
-    } else {
-      return false;
-    }
-
-    if (!getSecForVA(p->internal->secs, addr, s)) {
-      return false;
-    }
-
-    ::uint32_t rvaofft = addr - s.sectionBase;
-
-    // get the name of this module
-    ::uint32_t nameRva;
-    if (!readDword(s.sectionData,
-                   rvaofft + _offset(export_dir_table, NameRVA),
-                   nameRva)) {
-      return false;
-    }
-
-    VA nameVA;
-    if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
-      nameVA = nameRva + p->peHeader.nt.OptionalHeader.ImageBase;
-    } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
-      nameVA = nameRva + p->peHeader.nt.OptionalHeader64.ImageBase;
-    } else {
-      return false;
-    }
-
-    section nameSec;
-    if (!getSecForVA(p->internal->secs, nameVA, nameSec)) {
-      return false;
-    }
+  if (exportDir.Size == 0) {
+    return true;
+  }
 
-    ::uint32_t nameOff = nameVA - nameSec.sectionBase;
-    string modName;
-    if (!readCString(*nameSec.sectionData, nameOff, modName)) {
-      return false;
-    }
+  const section *s = nullptr;
+  VA addr = exportDir.VirtualAddress + t.imageBase;
+  if (!getSecForVA(p->internal, addr, s)) {
+    return false;
+  }
 
-    // now, get all the named export symbols
-    ::uint32_t numNames;
-    if (!readDword(s.sectionData,
-                   rvaofft + _offset(export_dir_table, NumberOfNamePointers),
-                   numNames)) {
+  ::uint32_t rvaofft = addr - s->sectionBase;
+  export_dir_table dir;
+  READ_DWORD(s->sectionData, rvaofft, dir, NameRVA);
+  READ_DWORD(s->sectionData, rvaofft, dir, OrdinalBase);
+  READ_DWORD(s->sectionData, rvaofft, dir, AddressTableEntries);
+  READ_DWORD(s->sectionData, rvaofft, dir, NumberOfNamePointers);
+  READ_DWORD(s->sectionData, rvaofft, dir, ExportAddressTableRVA);
+  READ_DWORD(s->sectionData, rvaofft, dir, NamePointerRVA);
+  READ_DWORD(s->sectionData, rvaofft, dir, OrdinalTableRVA);
+
+  t.dirRVA = exportDir.VirtualAddress;
+  t.dirSize = exportDir.Size;
+  t.nameRVA = dir.NameRVA;
+  t.ordinalBase = dir.OrdinalBase;
+  t.numFunctions = dir.AddressTableEntries;
+  t.numNames = dir.NumberOfNamePointers;
+
+  // the tables are only located here, the lookups check the bounds
+  auto locate = [&](::uint32_t rva, const section *&sec, ::uint32_t &off) {
+    VA va = rva + t.imageBase;
+    if (!getSecForVA(p->internal, va, sec)) {
       return false;
     }
+    off = va - sec->sectionBase;
+    return true;
+  };
 
-    if (numNames > 0) {
-      // get the names section
-      ::uint32_t namesRVA;
-      if (!readDword(s.sectionData,
-                     rvaofft + _offset(export_dir_table, NamePointerRVA),
-                     namesRVA)) {
-        return false;
-      }
-
-      VA namesVA;
-      if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
-        namesVA = namesRVA + p->peHeader.nt.OptionalHeader.ImageBase;
-      } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
-        namesVA = namesRVA + p->peHeader.nt.OptionalHeader64.ImageBase;
-      } else {
-        return false;
-      }
-
-      section namesSec;
-      if (!getSecForVA(p->internal->secs, namesVA, namesSec)) {
-        return false;
-      }
-
-      ::uint32_t namesOff = namesVA - namesSec.sectionBase;
-
-      // get the EAT section
-      ::uint32_t eatRVA;
-      if (!readDword(s.sectionData,
-                     rvaofft + _offset(export_dir_table, ExportAddressTableRVA),
-                     eatRVA)) {
-        return false;
-      }
-
-      VA eatVA;
-      if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
-        eatVA = eatRVA + p->peHeader.nt.OptionalHeader.ImageBase;
-      } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
-        eatVA = eatRVA + p->peHeader.nt.OptionalHeader64.ImageBase;
-      } else {
-        return false;
-      }
-
-      section eatSec;
-      if (!getSecForVA(p->internal->secs, eatVA, eatSec)) {
-        return false;
-      }
-
-      ::uint32_t eatOff = eatVA - eatSec.sectionBase;
-
-      // get the ordinal base
-      ::uint32_t ordinalBase;
-      if (!readDword(s.sectionData,
-                     rvaofft + _offset(export_dir_table, OrdinalBase),
-                     ordinalBase)) {
-        return false;
-      }
-
-      // get the ordinal table
-      ::uint32_t ordinalTableRVA;
-      if (!readDword(s.sectionData,
-                     rvaofft + _offset(export_dir_table, OrdinalTableRVA),
-                     ordinalTableRVA)) {
-        return false;
-      }
-
-      VA ordinalTableVA;
-      if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
-        ordinalTableVA =
-            ordinalTableRVA + p->peHeader.nt.OptionalHeader.ImageBase;
-      } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
-        ordinalTableVA =
-            ordinalTableRVA + p->peHeader.nt.OptionalHeader64.ImageBase;
-      } else {
-        return false;
-      }
-
-      section ordinalTableSec;
-      if (!getSecForVA(p->internal->secs, ordinalTableVA, ordinalTableSec)) {
-        return false;
-      }
-
-      ::uint32_t ordinalOff = ordinalTableVA - ordinalTableSec.sectionBase;
-
-      for (::uint32_t i = 0; i < numNames; i++) {
-        ::uint32_t curNameRVA;
-        if (!readDword(namesSec.sectionData,
-                       namesOff + (i * sizeof(::uint32_t)),
-                       curNameRVA)) {
-          return false;
-        }
-
-        VA curNameVA;
-        if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
-          curNameVA = curNameRVA + p->peHeader.nt.OptionalHeader.ImageBase;
-        } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
-          curNameVA = curNameRVA + p->peHeader.nt.OptionalHeader64.ImageBase;
-        } else {
-          return false;
-        }
-
-        section curNameSec;
-
-        if (!getSecForVA(p->internal->secs, curNameVA, curNameSec)) {
-          return false;
-        }
-
-        ::uint32_t curNameOff = curNameVA - curNameSec.sectionBase;
-        string symName;
-        ::uint8_t d;
-
-        do {
-          if (!readByte(curNameSec.sectionData, curNameOff, d)) {
-            return false;
-          }
-
-          if (d == 0) {
-            break;
-          }
-
-          symName.push_back(d);
-          curNameOff++;
-        } while (true);
-
-        // now, for this i, look it up in the ExportOrdinalTable
-        ::uint16_t ordinal;
-        if (!readWord(ordinalTableSec.sectionData,
-                      ordinalOff + (i * sizeof(uint16_t)),
-                      ordinal)) {
-          return false;
-        }
-
-        //::uint32_t  eatIdx = ordinal - ordinalBase;
-        ::uint32_t eatIdx = (ordinal * sizeof(uint32_t));
-
-        ::uint32_t symRVA;
-        if (!readDword(eatSec.sectionData, eatOff + eatIdx, symRVA)) {
-          return false;
-        }
-
-        bool isForwarded =
-            ((symRVA >= exportDir.VirtualAddress) &&
-             (symRVA < exportDir.VirtualAddress + exportDir.Size));
-
-        if (!isForwarded) {
-          ::uint32_t symVA;
-          if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
-            symVA = symRVA + p->peHeader.nt.OptionalHeader.ImageBase;
-          } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
-            symVA = symRVA + p->peHeader.nt.OptionalHeader64.ImageBase;
-          } else {
-            return false;
-          }
-
-          exportent a;
+  if (t.numFunctions > 0 &&
+      !locate(dir.ExportAddressTableRVA, t.eatSec, t.eatOff)) {
+    return false;
+  }
 
-          a.addr = symVA;
-          a.symbolName = symName;
-          a.moduleName = modName;
-          p->internal->exports.push_back(a);
-        }
-      }
-    }
+  if (t.numNames > 0 &&
+      (!locate(dir.NamePointerRVA, t.namesSec, t.namesOff) ||
+       !locate(dir.OrdinalTableRVA, t.ordinalSec, t.ordinalOff))) {
+    return false;
   }
 
+  t.present = true;
   return true;
 }
 
 bool getRelocations(parsed_pe *p) {
+  PE_STAGE("getRelocations");
   data_directory relocDir;
   if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
     relocDir = p->peHeader.nt.OptionalHeader.DataDirectory[DIR_BASERELOC];
@@ -1033,7 +949,7 @@ bool getRelocations(parsed_pe *p) {
   }
 
   if (relocDir.Size != 0) {
-    section d;
+    const section *d = nullptr;
     VA vaAddr;
     if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
       vaAddr =
@@ -1045,28 +961,53 @@ bool getRelocations(parsed_pe *p) {
       return false;
     }
 
-    if (!getSecForVA(p->internal->secs, vaAddr, d)) {
+    if (!getSecForVA(p->internal, vaAddr, d)) {
       return false;
     }
 
-    ::uint32_t rvaofft = vaAddr - d.sectionBase;
+    ::uint32_t rvaofft = vaAddr - d->sectionBase;
+
+    // count the entries first, reading just the block headers, so that the
+    // table is allocated once. a block can't be larger than the rest of the
+    // section, which also keeps blockOff from wrapping around
+    ::uint64_t relocCount = 0;
+    for (::uint32_t blockOff = rvaofft; blockOff < relocDir.Size;) {
+      ::uint32_t blockSize;
+      if (!readDword(d->sectionData,
+                     blockOff + _offset(reloc_block, BlockSize),
+                     blockSize) ||
+          blockSize < sizeof(reloc_block) ||
+          blockSize > bufLen(d->sectionData) - blockOff) {
+        break;
+      }
+      relocCount += (blockSize - 8) / sizeof(::uint16_t);
+      blockOff += sizeof(reloc_block) +
+                  ((blockSize - 8) / sizeof(::uint16_t)) * sizeof(::uint16_t);
+    }
+    p->internal->relocs.reserve(
+        std::min<::uint64_t>(relocCount, bufLen(p->fileBuffer) / 2));
 
     while (rvaofft < relocDir.Size) {
       ::uint32_t pageRva;
       ::uint32_t blockSize;
 
-      if (!readDword(d.sectionData,
+      if (!readDword(d->sectionData,
                      rvaofft + _offset(reloc_block, PageRVA),
                      pageRva)) {
         return false;
       }
 
-      if (!readDword(d.sectionData,
+      if (!readDword(d->sectionData,
                      rvaofft + _offset(reloc_block, BlockSize),
                      blockSize)) {
         return false;
       }
 
+      if (blockSize < sizeof(reloc_block) ||
+          blockSize > bufLen(d->sectionData) - rvaofft) {
+        return false;
+      }
+
       // BlockSize - The total number of bytes in the base relocation block,
       // including the Page RVA and Block Size fields and the Type/Offset fields
       // that follow. Therefore we should subtract 8 bytes from BlockSize to
@@ -1082,7 +1023,7 @@ bool getRelocations(parsed_pe *p) {
         ::uint8_t type;
         ::uint16_t offset;
 
-        if (!readWord(d.sectionData, rvaofft, entry)) {
+        if (!readWord(d->sectionData, rvaofft, entry)) {
           return false;
         }
 
@@ -1118,19 +1059,111 @@ bool getRelocations(parsed_pe *p) {
   return true;
 }
 
-bool getImports(parsed_pe *p) {
+// reads the lookup table at lookupVA, whose entries are bound into the address
+// table at iatVA, the same for both regular and delay-load imports. the names
+// are at nameBase plus the value of their entry
+static bool readThunks(parsed_pe *p,
+                       std::string_view modName,
+                       VA lookupVA,
+                       VA iatVA,
+                       VA nameBase,
+                       bool delayed) {
+  const section *lookupSec = nullptr;
+  if (lookupVA == 0 || !getSecForVA(p->internal, lookupVA, lookupSec)) {
+    return false;
+  }
+
+  ::uint64_t lookupOff = lookupVA - lookupSec->sectionBase;
+  ::uint32_t offInTable = 0;
+  do {
+    VA valVA = 0;
+    ::uint8_t ord = 0;
+    ::uint16_t oval = 0;
+    ::uint32_t val32 = 0;
+    ::uint64_t val64 = 0;
+    if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
+      if (!readDword(lookupSec->sectionData, lookupOff, val32)) {
+        return false;
+      }
+      if (val32 == 0) {
+        break;
+      }
+      ord = (val32 >> 31);
+      oval = (val32 & ~0xFFFF0000);
+      valVA = val32 + nameBase;
+    } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
+      if (!readQword(lookupSec->sectionData, lookupOff, val64)) {
+        return false;
+      }
+      if (val64 == 0) {
+        break;
+      }
+      ord = (val64 >> 63);
+      oval = (val64 & ~0xFFFF0000);
+      valVA = val64 + nameBase;
+    } else {
+      return false;
+    }
+
+    import_ref ent = {};
+    ent.addr = iatVA + offInTable;
+    ent.moduleName = modName;
+    ent.delayed = delayed;
+
+    if (ord == 0) {
+      // import by name
+      const section *symNameSec = nullptr;
+
+      if (!getSecForVA(p->internal, valVA, symNameSec)) {
+        return false;
+      }
+
+      ::uint32_t nameOff = valVA - symNameSec->sectionBase;
+      if (!readWord(symNameSec->sectionData, nameOff, ent.hint)) {
+        return false;
+      }
+      nameOff += sizeof(::uint16_t);
+      if (!readCStringView(*symNameSec->sectionData, nameOff, ent.symbolName)) {
+        return false;
+      }
+    } else {
+      ent.byOrdinal = true;
+      ent.ordinal = oval;
+    }
+
+    p->internal->imports.push_back(ent);
+
+    if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
+      lookupOff += sizeof(::uint32_t);
+      offInTable += sizeof(::uint32_t);
+    } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
+      lookupOff += sizeof(::uint64_t);
+      offInTable += sizeof(::uint64_t);
+    } else {
+      return false;
+    }
+  } while (true);
+
+  return true;
+}
+
+bool getImports(parsed_pe *p, bool walkThunks) {
+  PE_STAGE("getImports");
   data_directory importDir;
+  VA imageBase;
   if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
     importDir = p->peHeader.nt.OptionalHeader.DataDirectory[DIR_IMPORT];
+    imageBase = p->peHeader.nt.OptionalHeader.ImageBase;
   } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
     importDir = p->peHeader.nt.OptionalHeader64.DataDirectory[DIR_IMPORT];
+    imageBase = p->peHeader.nt.OptionalHeader64.ImageBase;
   } else {
     return false;
   }
 
   if (importDir.Size != 0) {
     // get section for the RVA in importDir
-    section c;
+    const section *c = nullptr;
     VA addr;
     if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
       addr = importDir.VirtualAddress + p->peHeader.nt.OptionalHeader.ImageBase;
@@ -1141,21 +1174,21 @@ bool getImports(parsed_pe *p) {
       return false;
     }
 
-    if (!getSecForVA(p->internal->secs, addr, c)) {
+    if (!getSecForVA(p->internal, addr, c)) {
       return false;
     }
 
     // get import directory from this section
-    ::uint32_t offt = addr - c.sectionBase;
+    ::uint32_t offt = addr - c->sectionBase;
     do {
       // read each directory entry out
       import_dir_entry curEnt;
 
-      READ_DWORD(c.sectionData, offt, curEnt, LookupTableRVA);
-      READ_DWORD(c.sectionData, offt, curEnt, TimeStamp);
-      READ_DWORD(c.sectionData, offt, curEnt, ForwarderChain);
-      READ_DWORD(c.sectionData, offt, curEnt, NameRVA);
-      READ_DWORD(c.sectionData, offt, curEnt, AddressRVA);
+      READ_DWORD(c->sectionData, offt, curEnt, LookupTableRVA);
+      READ_DWORD(c->sectionData, offt, curEnt, TimeStamp);
+      READ_DWORD(c->sectionData, offt, curEnt, ForwarderChain);
+      READ_DWORD(c->sectionData, offt, curEnt, NameRVA);
+      READ_DWORD(c->sectionData, offt, curEnt, AddressRVA);
 
       // are all the fields in curEnt null? then we break
       if (curEnt.LookupTableRVA == 0 && curEnt.NameRVA == 0 &&
@@ -1173,18 +1206,22 @@ bool getImports(parsed_pe *p) {
         return false;
       }
 
-      section nameSec;
-      if (!getSecForVA(p->internal->secs, name, nameSec)) {
+      const section *nameSec = nullptr;
+      if (!getSecForVA(p->internal, name, nameSec)) {
         return false;
       }
 
-      ::uint32_t nameOff = name - nameSec.sectionBase;
-      string modName;
-      if (!readCString(*nameSec.sectionData, nameOff, modName)) {
+      ::uint32_t nameOff = name - nameSec->sectionBase;
+      std::string_view modName;
+      if (!readCStringView(*nameSec->sectionData, nameOff, modName)) {
         return false;
       }
-      std::transform(
-          modName.begin(), modName.end(), modName.begin(), ::toupper);
+      p->internal->importModules.push_back(modName);
+
+      if (!walkThunks) {
+        offt += sizeof(import_dir_entry);
+        continue;
+      }
 
       // then, try and get all of the sub-symbols
       VA lookupVA = 0;
@@ -1210,122 +1247,86 @@ bool getImports(parsed_pe *p) {
         }
       }
 
-      section lookupSec;
-      if (lookupVA == 0 ||
-          !getSecForVA(p->internal->secs, lookupVA, lookupSec)) {
+      VA iatVA = curEnt.AddressRVA + imageBase;
+      if (!readThunks(p, modName, lookupVA, iatVA, imageBase, false)) {
         return false;
       }
 
-      ::uint64_t lookupOff = lookupVA - lookupSec.sectionBase;
-      ::uint32_t offInTable = 0;
-      do {
-        VA valVA = 0;
-        ::uint8_t ord = 0;
-        ::uint16_t oval = 0;
-        ::uint32_t val32 = 0;
-        ::uint64_t val64 = 0;
-        if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
-          if (!readDword(lookupSec.sectionData, lookupOff, val32)) {
-            return false;
-          }
-          if (val32 == 0) {
-            break;
-          }
-          ord = (val32 >> 31);
-          oval = (val32 & ~0xFFFF0000);
-          valVA = val32 + p->peHeader.nt.OptionalHeader.ImageBase;
-        } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
-          if (!readQword(lookupSec.sectionData, lookupOff, val64)) {
-            return false;
-          }
-          if (val64 == 0) {
-            break;
-          }
-          ord = (val64 >> 63);
-          oval = (val64 & ~0xFFFF0000);
-          valVA = val64 + p->peHeader.nt.OptionalHeader64.ImageBase;
-        } else {
-          return false;
-        }
+      offt += sizeof(import_dir_entry);
+    } while (true);
+  }
 
-        if (ord == 0) {
-          // import by name
-          string symName;
-          section symNameSec;
+  return true;
+}
 
-          if (!getSecForVA(p->internal->secs, valVA, symNameSec)) {
-            return false;
-          }
+bool getDelayImports(parsed_pe *p, bool walkThunks) {
+  PE_STAGE("getDelayImports");
+  data_directory delayDir;
+  VA imageBase;
+  if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
+    delayDir = p->peHeader.nt.OptionalHeader.DataDirectory[DIR_DELAY_IMPORT];
+    imageBase = p->peHeader.nt.OptionalHeader.ImageBase;
+  } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
+    delayDir = p->peHeader.nt.OptionalHeader64.DataDirectory[DIR_DELAY_IMPORT];
+    imageBase = p->peHeader.nt.OptionalHeader64.ImageBase;
+  } else {
+    return false;
+  }
 
-          ::uint32_t nameOff = valVA - symNameSec.sectionBase;
-          nameOff += sizeof(::uint16_t);
-          do {
-            ::uint8_t d;
-
-            if (!readByte(symNameSec.sectionData, nameOff, d)) {
-              return false;
-            }
-
-            if (d == 0) {
-              break;
-            }
-
-            symName.push_back(d);
-            nameOff++;
-          } while (true);
-
-          // okay now we know the pair... add it
-          importent ent;
-
-          if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
-            ent.addr = offInTable + curEnt.AddressRVA +
-                       p->peHeader.nt.OptionalHeader.ImageBase;
-          } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
-            ent.addr = offInTable + curEnt.AddressRVA +
-                       p->peHeader.nt.OptionalHeader64.ImageBase;
-          } else {
-            return false;
-          }
+  if (delayDir.Size == 0) {
+    return true;
+  }
 
-          ent.symbolName = symName;
-          ent.moduleName = modName;
-          p->internal->imports.push_back(ent);
-        } else {
-          string symName =
-              "ORDINAL_" + modName + "_" + to_string<uint32_t>(oval, dec);
-
-          importent ent;
-
-          if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
-            ent.addr = offInTable + curEnt.AddressRVA +
-                       p->peHeader.nt.OptionalHeader.ImageBase;
-          } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
-            ent.addr = offInTable + curEnt.AddressRVA +
-                       p->peHeader.nt.OptionalHeader64.ImageBase;
-          } else {
-            return false;
-          }
+  const section *c = nullptr;
+  VA addr = delayDir.VirtualAddress + imageBase;
+  if (!getSecForVA(p->internal, addr, c)) {
+    return false;
+  }
 
-          ent.symbolName = symName;
-          ent.moduleName = modName;
+  ::uint32_t offt = addr - c->sectionBase;
+  do {
+    delay_import_dir_entry curEnt;
+
+    READ_DWORD(c->sectionData, offt, curEnt, Attributes);
+    READ_DWORD(c->sectionData, offt, curEnt, NameRVA);
+    READ_DWORD(c->sectionData, offt, curEnt, ModuleHandleRVA);
+    READ_DWORD(c->sectionData, offt, curEnt, AddressRVA);
+    READ_DWORD(c->sectionData, offt, curEnt, NameTableRVA);
+    READ_DWORD(c->sectionData, offt, curEnt, BoundAddressRVA);
+    READ_DWORD(c->sectionData, offt, curEnt, UnloadAddressRVA);
+    READ_DWORD(c->sectionData, offt, curEnt, TimeStamp);
+
+    // the table ends with an empty entry
+    if (curEnt.NameRVA == 0) {
+      break;
+    }
 
-          p->internal->imports.push_back(ent);
-        }
+    // entries without the RVA attribute hold VAs, as written by old linkers
+    VA base = (curEnt.Attributes & DELAY_IMPORT_ATTR_RVA) ? imageBase : 0;
 
-        if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
-          lookupOff += sizeof(::uint32_t);
-          offInTable += sizeof(::uint32_t);
-        } else if (p->peHeader.nt.OptionalMagic == NT_OPTIONAL_64_MAGIC) {
-          lookupOff += sizeof(::uint64_t);
-          offInTable += sizeof(::uint64_t);
-        } else {
-          return false;
-        }
-      } while (true);
+    const section *nameSec = nullptr;
+    VA name = curEnt.NameRVA + base;
+    if (!getSecForVA(p->internal, name, nameSec)) {
+      return false;
+    }
 
-      offt += sizeof(import_dir_entry);
-    } while (true);
-  }
+    std::string_view modName;
+    if (!readCStringView(
+            *nameSec->sectionData, name - nameSec->sectionBase, modName)) {
+      return false;
+    }
+    p->internal->delayImportModules.push_back(modName);
+
+    if (walkThunks && curEnt.NameTableRVA != 0) {
+      VA lookupVA = curEnt.NameTableRVA + base;
+      VA iatVA = curEnt.AddressRVA + base;
+      if (!readThunks(p, modName, lookupVA, iatVA, base, true)) {
+        return false;
+      }
+    }
+
+    offt += sizeof(delay_import_dir_entry);
+  } while (true);
 
   return true;
 }
@@ -1341,6 +1342,10 @@ bool getSymbolTable(parsed_pe *p) {
 
   uint32_t offset = p->peHeader.nt.FileHeader.PointerToSymbolTable;
 
+  p->internal->symbols.reserve(
+      std::min<::uint64_t>(p->peHeader.nt.FileHeader.NumberOfSymbols,
+                           bufLen(p->fileBuffer) / SYMTAB_RECORD_LEN));
+
   for (uint32_t i = 0; i < p->peHeader.nt.FileHeader.NumberOfSymbols; i++) {
     symbol sym;
 
@@ -1608,7 +1613,17 @@ bool getSymbolTable(parsed_pe *p) {
   return true;
 }
 
-parsed_pe *ParsePEFromFile(const char *filePath) {
+#ifdef PEPARSE_STAGE_HOOKS
+stage_hook detail::stageHook = nullptr;
+
+void SetStageHook(stage_hook hook) {
+  detail::stageHook = hook;
+}
+#endif
+
+parsed_pe *ParsePEFromFile(const char *filePath, ::uint32_t stages) {
+  err = pe_error{PEERR_NONE, nullptr, 0};
+
   // First, create a new parsed_pe structure
   // We pass std::nothrow parameter to new so in case of failure it returns
   // nullptr instead of throwing exception std::bad_alloc.
@@ -1637,11 +1652,13 @@ parsed_pe *ParsePEFromFile(const char *filePath) {
     return nullptr;
   }
 
+  // From here on, DestructParsedPE releases the file and whatever the stages
+  // managed to collect before failing
+
   // get header information
   bounded_buffer *remaining = nullptr;
   if (!getHeader(p->fileBuffer, p->peHeader, remaining)) {
-    deleteBuffer(p->fileBuffer);
-    delete p;
+    DestructParsedPE(p);
     // err is set by getHeader
     return nullptr;
   }
@@ -1649,45 +1666,57 @@ parsed_pe *ParsePEFromFile(const char *filePath) {
   bounded_buffer *file = p->fileBuffer;
   if (!getSections(remaining, file, p->peHeader.nt, p->internal->secs)) {
     deleteBuffer(remaining);
-    deleteBuffer(p->fileBuffer);
-    delete p;
+    DestructParsedPE(p);
     PE_ERR(PEERR_SECT);
     return nullptr;
   }
+  buildSectionIndex(*p->internal);
 
-  if (!getResources(remaining, file, p->internal->secs, p->internal->rsrcs)) {
+  if ((stages & PARSE_RESOURCES) &&
+      !getResources(remaining, file, p->internal->secs, p->internal->rsrcs)) {
     deleteBuffer(remaining);
-    deleteBuffer(p->fileBuffer);
-    delete p;
+    DestructParsedPE(p);
     PE_ERR(PEERR_RESC);
     return nullptr;
   }
 
-  // Get exports
-  if (!getExports(p)) {
+  // Get exports, only where the tables are, they are read when looked up
+  if ((stages & PARSE_EXPORTS) && !getExportTable(p)) {
     deleteBuffer(remaining);
-    deleteBuffer(p->fileBuffer);
-    delete p;
+    DestructParsedPE(p);
     PE_ERR(PEERR_MAGIC);
     return nullptr;
   }
 
   // Get relocations, if exist
-  if (!getRelocations(p)) {
+  if ((stages & PARSE_RELOCATIONS) && !getRelocations(p)) {
     deleteBuffer(remaining);
-    deleteBuffer(p->fileBuffer);
-    delete p;
+    DestructParsedPE(p);
     PE_ERR(PEERR_MAGIC);
     return nullptr;
   }
 
-  // Get imports
-  if (!getImports(p)) {
+  // Get imports, optionally just the module names
+  if ((stages & (PARSE_IMPORTS | PARSE_IMPORT_MODULES)) &&
+      !getImports(p, (stages & PARSE_IMPORTS) != 0)) {
     deleteBuffer(remaining);
-    deleteBuffer(p->fileBuffer);
-    delete p;
+    DestructParsedPE(p);
+    PE_ERR(PEERR_MAGIC);
     return nullptr;
   }
+  // a malformed delay-load table only costs the modules loaded on first use,
+  // so it's dropped as a whole, and the rest of the file is still usable
+  if ((stages & (PARSE_IMPORTS | PARSE_IMPORT_MODULES)) &&
+      !getDelayImports(p, (stages & PARSE_IMPORTS) != 0)) {
+    PE_ERR(PEERR_MAGIC);
+    p->internal->delayImportError = err;
+    p->internal->delayImportModules.clear();
+    auto &imports = p->internal->imports;
+    imports.erase(std::remove_if(imports.begin(),
+                                 imports.end(),
+                                 [](const import_ref &i) { return i.delayed; }),
+                  imports.end());
+  }
 //
 //  // Get symbol table
 //  if (!getSymbolTable(p)) {
@@ -1702,6 +1731,13 @@ parsed_pe *ParsePEFromFile(const char *filePath) {
   return p;
 }
 
+parse_result ParsePE(const char *filePath, ::uint32_t stages) {
+  parse_result r;
+  r.pe.reset(ParsePEFromFile(filePath, stages));
+  r.error = r.pe ? pe_error{PEERR_NONE, nullptr, 0} : err;
+  return r;
+}
+
 void DestructParsedPE(parsed_pe *p) {
   if (p == nullptr) {
     return;
@@ -1709,12 +1745,12 @@ void DestructParsedPE(parsed_pe *p) {
 
   deleteBuffer(p->fileBuffer);
 
-  for (section s : p->internal->secs) {
+  for (const section &s : p->internal->secs) {
     if (s.sectionData != nullptr) {
       deleteBuffer(s.sectionData);
     }
   }
-  for (resource r : p->internal->rsrcs) {
+  for (const resource &r : p->internal->rsrcs) {
     if (r.buf != nullptr) {
       deleteBuffer(r.buf);
     }
@@ -1725,12 +1761,36 @@ void DestructParsedPE(parsed_pe *p) {
   return;
 }
 
-// iterate over the imports by VA and string
+// iterate over the imports by VA and string, this is the copying interface,
+// ForEachImport avoids the copies
 void IterImpVAString(parsed_pe *pe, iterVAStr cb, void *cbd) {
-  list<importent> &l = pe->internal->imports;
+  for (const import_ref &i : GetImports(pe)) {
+    if (i.delayed) {
+      continue;
+    }
+    string modName(i.moduleName);
+    std::transform(modName.begin(), modName.end(), modName.begin(), ::toupper);
+    string symName;
+    if (i.byOrdinal) {
+      symName =
+          "ORDINAL_" + modName + "_" + to_string<uint32_t>(i.ordinal, dec);
+    } else {
+      symName.assign(i.symbolName);
+    }
+    if (cb(cbd, i.addr, modName, symName) != 0) {
+      break;
+    }
+  }
+
+  return;
+}
 
-  for (importent i : l) {
-    if (cb(cbd, i.addr, i.moduleName, i.symbolName) != 0) {
+// iterate over the names of the imported modules
+void IterImpModules(parsed_pe *pe, iterImpMod cb, void *cbd) {
+  for (std::string_view m : GetImportModules(pe)) {
+    string modName(m);
+    std::transform(modName.begin(), modName.end(), modName.begin(), ::toupper);
+    if (cb(cbd, modName) != 0) {
       break;
     }
   }
@@ -1738,11 +1798,165 @@ void IterImpVAString(parsed_pe *pe, iterVAStr cb, void *cbd) {
   return;
 }
 
+table_view<import_ref> GetImports(const parsed_pe *pe) {
+  const vector<import_ref> &l = pe->internal->imports;
+  return {l.data(), l.size()};
+}
+
+table_view<std::string_view> GetImportModules(const parsed_pe *pe) {
+  const vector<std::string_view> &l = pe->internal->importModules;
+  return {l.data(), l.size()};
+}
+
+table_view<std::string_view> GetDelayImportModules(const parsed_pe *pe) {
+  const vector<std::string_view> &l = pe->internal->delayImportModules;
+  return {l.data(), l.size()};
+}
+
+pe_error GetDelayImportError(const parsed_pe *pe) {
+  return pe->internal->delayImportError;
+}
+
+// reads entry i of the export name pointer table
+static bool readExportName(const parsed_pe *pe,
+                           ::uint32_t i,
+                           std::string_view &name) {
+  const export_table &t = pe->internal->exportTable;
+  ::uint32_t nameRVA;
+  if (i >= t.numNames || !readDword(t.namesSec->sectionData,
+                                    t.namesOff + i * sizeof(::uint32_t),
+                                    nameRVA)) {
+    return false;
+  }
+
+  const section *sec = nullptr;
+  VA nameVA = nameRVA + t.imageBase;
+  if (!getSecForVA(pe->internal, nameVA, sec)) {
+    return false;
+  }
+
+  return readCStringView(*sec->sectionData, nameVA - sec->sectionBase, name);
+}
+
+// reads entry i of the export address table, which is either the exported
+// address or, when it points into the export directory, a forwarder string
+static bool readExportAddress(const parsed_pe *pe,
+                              ::uint32_t i,
+                              export_ref &out) {
+  const export_table &t = pe->internal->exportTable;
+  ::uint32_t rva;
+  if (i >= t.numFunctions || !readDword(t.eatSec->sectionData,
+                                        t.eatOff + i * sizeof(::uint32_t),
+                                        rva)) {
+    return false;
+  }
+
+  out.ordinal = static_cast<::uint16_t>(t.ordinalBase + i);
+  out.rva = rva;
+  out.forwarder = std::string_view();
+  if (rva >= t.dirRVA && rva < t.dirRVA + t.dirSize) {
+    const section *sec = nullptr;
+    VA forwarderVA = rva + t.imageBase;
+    if (!getSecForVA(pe->internal, forwarderVA, sec) ||
+        !readCStringView(
+            *sec->sectionData, forwarderVA - sec->sectionBase, out.forwarder)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+std::size_t export_view::size() const {
+  return pe->internal->exportTable.numNames;
+}
+
+std::string_view export_view::moduleName() const {
+  const export_table &t = pe->internal->exportTable;
+  const section *sec = nullptr;
+  std::string_view name;
+  VA nameVA = t.nameRVA + t.imageBase;
+  if (!t.present || !getSecForVA(pe->internal, nameVA, sec) ||
+      !readCStringView(*sec->sectionData, nameVA - sec->sectionBase, name)) {
+    return std::string_view();
+  }
+  return name;
+}
+
+bool export_view::at(std::size_t i, export_ref &out) const {
+  const export_table &t = pe->internal->exportTable;
+  if (!t.present || !readExportName(pe, i, out.name)) {
+    return false;
+  }
+
+  // the ordinal table maps the names to export address table entries
+  ::uint16_t index;
+  if (!readWord(t.ordinalSec->sectionData,
+                t.ordinalOff + i * sizeof(::uint16_t),
+                index)) {
+    return false;
+  }
+
+  return readExportAddress(pe, index, out);
+}
+
+bool export_view::find(std::string_view name,
+                       export_ref &out,
+                       std::uint16_t hint) const {
+  const export_table &t = pe->internal->exportTable;
+  if (!t.present || t.numNames == 0) {
+    return false;
+  }
+
+  // the hint is right as long as the DLL didn't change since the importer
+  // was linked
+  std::string_view candidate;
+  if (readExportName(pe, hint, candidate) && candidate == name) {
+    return at(hint, out);
+  }
+
+  // the name table is sorted, so that the loader can binary search it too
+  ::uint32_t low = 0;
+  ::uint32_t high = t.numNames;
+  while (low < high) {
+    ::uint32_t mid = low + (high - low) / 2;
+    if (!readExportName(pe, mid, candidate)) {
+      return false;
+    }
+    int c = candidate.compare(name);
+    if (c == 0) {
+      return at(mid, out);
+    }
+    if (c < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return false;
+}
+
+bool export_view::findOrdinal(std::uint16_t ordinal, export_ref &out) const {
+  const export_table &t = pe->internal->exportTable;
+  if (!t.present || ordinal < t.ordinalBase) {
+    return false;
+  }
+
+  // unused slots in the export address table are zero
+  out.name = std::string_view();
+  return readExportAddress(pe, ordinal - t.ordinalBase, out) && out.rva != 0;
+}
+
+export_view GetExports(const parsed_pe *pe) {
+  return export_view{pe};
+}
+
 // iterate over relocations in the PE file
 void IterRelocs(parsed_pe *pe, iterReloc cb, void *cbd) {
-  list<reloc> &l = pe->internal->relocs;
+  vector<reloc> &l = pe->internal->relocs;
 
-  for (reloc r : l) {
+  for (const reloc &r : l) {
     if (cb(cbd, r.shiftedAddr, r.type) != 0) {
       break;
     }
@@ -1753,9 +1967,9 @@ void IterRelocs(parsed_pe *pe, iterReloc cb, void *cbd) {
 
 // Iterate over symbols (symbol table) in the PE file
 void IterSymbols(parsed_pe *pe, iterSymbol cb, void *cbd) {
-  list<symbol> &l = pe->internal->symbols;
+  vector<symbol> &l = pe->internal->symbols;
 
-  for (symbol s : l) {
+  for (symbol &s : l) {
     if (cb(cbd,
            s.strName,
            s.value,
@@ -1772,10 +1986,22 @@ void IterSymbols(parsed_pe *pe, iterSymbol cb, void *cbd) {
 
 // iterate over the exports by VA
 void IterExpVA(parsed_pe *pe, iterExp cb, void *cbd) {
-  list<exportent> &l = pe->internal->exports;
+  export_view exports = GetExports(pe);
+  string modName(exports.moduleName());
+
+  for (std::size_t i = 0; i < exports.size(); i++) {
+    export_ref e;
+    if (!exports.at(i, e)) {
+      break;
+    }
+    if (e.forwarded()) {
+      continue;
+    }
 
-  for (exportent i : l) {
-    if (cb(cbd, i.addr, i.moduleName, i.symbolName) != 0) {
+    // the addresses have always been truncated to 32 bits here
+    ::uint32_t symVA = e.rva + pe->internal->exportTable.imageBase;
+    string symName(e.name);
+    if (cb(cbd, symVA, modName, symName) != 0) {
       break;
     }
   }
@@ -1787,7 +2013,7 @@ void IterExpVA(parsed_pe *pe, iterExp cb, void *cbd) {
 void IterSec(parsed_pe *pe, iterSec cb, void *cbd) {
   parsed_pe_internal *pint = pe->internal;
 
-  for (section s : pint->secs) {
+  for (section &s : pint->secs) {
     if (cb(cbd, s.sectionBase, s.sectionName, s.sec, s.sectionData) != 0) {
       break;
     }
@@ -1798,16 +2024,16 @@ void IterSec(parsed_pe *pe, iterSec cb, void *cbd) {
 
 bool ReadByteAtVA(parsed_pe *pe, VA v, ::uint8_t &b) {
   // find this VA in a section
-  section s;
+  const section *s = nullptr;
 
-  if (!getSecForVA(pe->internal->secs, v, s)) {
+  if (!getSecForVA(pe->internal, v, s)) {
     PE_ERR(PEERR_SECTVA);
     return false;
   }
 
-  ::uint32_t off = v - s.sectionBase;
+  ::uint32_t off = v - s->sectionBase;
 
-  return readByte(s.sectionData, off, b);
+  return readByte(s->sectionData, off, b);
 }
 
 bool GetEntryPoint(parsed_pe *pe, VA &v) {
@@ -24,8 +24,12 @@ THE SOFTWARE.
 
 #ifndef _PARSE_H
 #define _PARSE_H
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
 #include "nt-headers.h"
 #include "to_string.h"
@@ -34,10 +38,9 @@ THE SOFTWARE.
 #define __typeof__(x) std::remove_reference < decltype(x) > ::type
 #endif
 
-#define PE_ERR(x)           \
-  err = (pe_err) x;         \
-  err_loc.assign(__func__); \
-  err_loc += ":" + to_string<std::uint32_t>(__LINE__, dec);
+// records where the error was raised without allocating, the message and
+// location strings are only built when asked for
+#define PE_ERR(x) err = pe_error{(pe_err) x, __func__, __LINE__};
 
 #define READ_WORD(b, o, inst, member)                                     \
   if (!readWord(b, o + _offset(__typeof__(inst), member), inst.member)) { \
@@ -79,6 +82,14 @@ THE SOFTWARE.
 #define TEST_MACHINE_CHARACTERISTICS(h, m, ch) \
   ((h.FileHeader.Machine == m) && (h.FileHeader.Characteristics & ch))
 
+// reports the stage the enclosing function is for to the stage hook, only
+// when built with PEPARSE_STAGE_HOOKS
+#ifdef PEPARSE_STAGE_HOOKS
+#define PE_STAGE(x) detail::stage_scope stageScope(x)
+#else
+#define PE_STAGE(x)
+#endif
+
 namespace peparse {
 
 typedef std::uint32_t RVA;
@@ -145,6 +156,13 @@ enum pe_err {
   PEERR_MAGIC = 9
 };
 
+// an error raised while parsing, func points at a string literal
+struct pe_error {
+  pe_err code;
+  const char *func;
+  std::uint32_t line;
+};
+
 bool readByte(bounded_buffer *b, std::uint32_t offset, std::uint8_t &out);
 bool readWord(bounded_buffer *b, std::uint32_t offset, std::uint16_t &out);
 bool readDword(bounded_buffer *b, std::uint32_t offset, std::uint32_t &out);
@@ -175,20 +193,211 @@ std::string GetPEErrString();
 // get parser error location as string
 std::string GetPEErrLoc();
 
-// get a PE parse context from a file
-parsed_pe *ParsePEFromFile(const char *filePath);
+// the same for an error returned by ParsePE
+std::string GetPEErrString(const pe_error &e);
+std::string GetPEErrLoc(const pe_error &e);
+
+// stages that ParsePEFromFile can run, the headers and the section table are
+// always parsed
+enum parse_stage : std::uint32_t {
+  PARSE_RESOURCES = 0x1,
+  PARSE_EXPORTS = 0x2,
+  PARSE_RELOCATIONS = 0x4,
+  PARSE_IMPORTS = 0x8,
+  // only the module names from the import directory, without walking thunks
+  PARSE_IMPORT_MODULES = 0x10,
+  PARSE_ALL =
+      PARSE_RESOURCES | PARSE_EXPORTS | PARSE_RELOCATIONS | PARSE_IMPORTS
+};
+
+// get a PE parse context from a file, running only the requested stages
+parsed_pe *ParsePEFromFile(const char *filePath,
+                           std::uint32_t stages = PARSE_ALL);
 
 // destruct a PE context
 void DestructParsedPE(parsed_pe *p);
 
+// owning handle for a PE context, unmaps the file when it goes out of scope
+struct parsed_pe_deleter {
+  void operator()(parsed_pe *p) const {
+    DestructParsedPE(p);
+  }
+};
+typedef std::unique_ptr<parsed_pe, parsed_pe_deleter> parsed_pe_handle;
+
+// the outcome of one ParsePE call, error.code is PEERR_NONE when pe is set
+struct parse_result {
+  parsed_pe_handle pe;
+  pe_error error;
+};
+
+// like ParsePEFromFile, but returns the error of this call instead of leaving
+// it for GetPEErr, so it stays correct when several threads are parsing
+parse_result ParsePE(const char *filePath, std::uint32_t stages = PARSE_ALL);
+
+#ifdef PEPARSE_STAGE_HOOKS
+// called on the parsing thread when a stage of ParsePEFromFile (mapping the
+// file, reading the headers, the sections, the imports, ...) starts and again
+// when it ends, to profile the parser
+typedef void (*stage_hook)(const char *stage, bool end);
+void SetStageHook(stage_hook hook);
+
+namespace detail {
+extern stage_hook stageHook;
+
+struct stage_scope {
+  const char *stage;
+
+  explicit stage_scope(const char *s) : stage(s) {
+    if (stageHook != nullptr) {
+      stageHook(stage, false);
+    }
+  }
+  ~stage_scope() {
+    if (stageHook != nullptr) {
+      stageHook(stage, true);
+    }
+  }
+};
+} // namespace detail
+#endif
+
 // iterate over the resources
 typedef int (*iterRsrc)(void *, resource);
 void IterRsrc(parsed_pe *pe, iterRsrc cb, void *cbd);
 
-// iterate over the imports by RVA and string
+// iterate over the imports by RVA and string, without the delay-load ones
 typedef int (*iterVAStr)(void *, VA, std::string &, std::string &);
 void IterImpVAString(parsed_pe *pe, iterVAStr cb, void *cbd);
 
+// iterate over the names of the imported modules, available with both
+// PARSE_IMPORTS and PARSE_IMPORT_MODULES
+typedef int (*iterImpMod)(void *, std::string &);
+void IterImpModules(parsed_pe *pe, iterImpMod cb, void *cbd);
+
+// an imported symbol, the names point into the mapped file and stay valid
+// until the parsed_pe is destructed
+struct import_ref {
+  VA addr;
+  // as spelled in the file, IterImpVAString upper-cases it
+  std::string_view moduleName;
+  // empty for imports by ordinal
+  std::string_view symbolName;
+  bool byOrdinal;
+  // from the delay-load table, bound on the first call instead of at load
+  bool delayed;
+  std::uint16_t ordinal;
+  // the index into the exporter's name table when the importer was linked
+  std::uint16_t hint;
+};
+
+// a contiguous range of entries in one of the parsed tables
+template <class T>
+struct table_view {
+  const T *first;
+  std::size_t count;
+
+  const T *begin() const {
+    return first;
+  }
+  const T *end() const {
+    return first + count;
+  }
+  std::size_t size() const {
+    return count;
+  }
+};
+
+table_view<import_ref> GetImports(const parsed_pe *pe);
+table_view<std::string_view> GetImportModules(const parsed_pe *pe);
+// the modules from the delay-load table, which GetImportModules doesn't include
+table_view<std::string_view> GetDelayImportModules(const parsed_pe *pe);
+// why the delay-load table couldn't be read, PEERR_NONE when it could (or
+// there is none). a malformed table doesn't fail the parse, its modules and
+// imports are left out and the rest stays valid
+pe_error GetDelayImportError(const parsed_pe *pe);
+
+namespace detail {
+// calls f with args, a callback that returns a value stops the iteration by
+// returning true (or non-zero), one that returns void never stops it
+template <class F, class... Args>
+inline bool callStops(F &f, Args &&... args) {
+  if constexpr (std::is_void_v<std::invoke_result_t<F &, Args...>>) {
+    f(std::forward<Args>(args)...);
+    return false;
+  } else {
+    return static_cast<bool>(f(std::forward<Args>(args)...));
+  }
+}
+} // namespace detail
+
+// iterate over the imports without copying them, with PARSE_IMPORTS
+template <class F>
+inline void ForEachImport(const parsed_pe *pe, F &&f) {
+  for (const import_ref &i : GetImports(pe)) {
+    if (detail::callStops(f, i)) {
+      break;
+    }
+  }
+}
+
+// iterate over the imported module names without copying them, with both
+// PARSE_IMPORTS and PARSE_IMPORT_MODULES
+template <class F>
+inline void ForEachImportModule(const parsed_pe *pe, F &&f) {
+  for (std::string_view m : GetImportModules(pe)) {
+    if (detail::callStops(f, m)) {
+      break;
+    }
+  }
+}
+
+// the same for the delay-loaded modules
+template <class F>
+inline void ForEachDelayImportModule(const parsed_pe *pe, F &&f) {
+  for (std::string_view m : GetDelayImportModules(pe)) {
+    if (detail::callStops(f, m)) {
+      break;
+    }
+  }
+}
+
+// an exported symbol, the names point into the mapped file
+struct export_ref {
+  // empty when looked up by ordinal
+  std::string_view name;
+  std::uint16_t ordinal;
+  // the exported RVA, or the RVA of the forwarder string
+  std::uint32_t rva;
+  // "MODULE.Symbol" or "MODULE.#ordinal" for exports forwarded to another DLL
+  std::string_view forwarder;
+
+  bool forwarded() const {
+    return !forwarder.empty();
+  }
+};
+
+// the export table of a file parsed with PARSE_EXPORTS, the entries are read
+// from the mapped file when asked for, so nothing is allocated
+struct export_view {
+  const parsed_pe *pe;
+
+  // the number of named exports
+  std::size_t size() const;
+  // the name the DLL was linked with
+  std::string_view moduleName() const;
+  // the named export at index i of the (sorted) name table
+  bool at(std::size_t i, export_ref &out) const;
+  // looks up a named export, the name table entry at hint is checked before
+  // the binary search
+  bool find(std::string_view name,
+            export_ref &out,
+            std::uint16_t hint = 0) const;
+  bool findOrdinal(std::uint16_t ordinal, export_ref &out) const;
+};
+
+export_view GetExports(const parsed_pe *pe);
+
 // iterate over relocations in the PE file
 typedef int (*iterReloc)(void *, VA, reloc_type);
 void IterRelocs(parsed_pe *pe, iterReloc cb, void *cbd);
@@ -3,14 +3,52 @@
 #include <set>
 #include <vector>
 #include <optional>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <map>
 #include <memory>
 #include <functional>
 #include <iomanip>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <fstream>
+#include <list>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <sys/stat.h>
+#include <ctime>
+#include <cstring>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
 #include <boost/program_options.hpp>
 // Using boost::filesystem here, because the gcc distribution from msys2 currently doesn't have std::filesystem
 #include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#ifdef WDEPS_STATS
+#include "counting_new.h"
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 using namespace peparse;
 using namespace std;
@@ -32,247 +70,2099 @@ vector<string> split(const string& s, char delimiter) {
     return result;
 }
 
-vector<string> getPathEnv() {
-    // TODO: portable shit, make configurable for cross-system use
-    string path = getenv("PATH");
-    auto parts = split(path, ';');
+vector<string> splitPathList(const string& list) {
+    auto parts = split(list, ';');
     for (auto& s : parts) {
-        if (s[s.length() - 1] == '/' || s[s.length() - 1] == '\\') {
+        if (!s.empty() && (s[s.length() - 1] == '/' || s[s.length() - 1] == '\\')) {
             s.pop_back();
         }
     }
     return parts;
 }
 
-string getFileNameWithCorrectCase(const std::string& existingFile) {
-    // TODO: portable shit, also this is a hacky but quick way to get the file name with the correct case
-    char shortBuffer[MAX_PATH];
-    char longBuffer[MAX_PATH];
-    // TODO: also check for failures
-    GetShortPathNameA(existingFile.c_str(), shortBuffer, MAX_PATH);
-    GetLongPathNameA(shortBuffer, longBuffer, MAX_PATH);
-    return fs::path(longBuffer).filename().string();
+vector<string> getPathEnv() {
+#ifdef _WIN32
+    auto path = getenv("PATH");
+    return path ? splitPathList(path) : vector<string>{};
+#else
+    // PATH on other hosts lists native directories, the search path for a sysroot has to be given explicitly
+    return {};
+#endif
 }
 
+#ifdef _WIN32
 fs::path systemDirectory() {
-    // TODO: portable shit
     char buffer[MAX_PATH];
     GetSystemDirectoryA(buffer, MAX_PATH);
     return string(buffer);
 }
 
 fs::path windowsDirectory() {
-    // TODO: portable shit
     char buffer[MAX_PATH];
     GetWindowsDirectoryA(buffer, MAX_PATH);
     return string(buffer);
 }
+#endif
+
+#ifdef WDEPS_STATS
+// Where the time of a scan goes, for --stats and --trace. Phases nest (the parses happen while the
+// graph is built, the walks while the reports are printed), and with more than one job their times
+// add up over the threads, so the wall time of a phase can exceed the one of the run. When tracing,
+// every timed scope is also kept as a span on the track of its thread.
+class Stats {
+public:
+    enum Phase {
+        Resolve, ListDirectory, BuildGraph, Walk, Report, Output, Copy,
+        MapFile, ParseHeader, ParseSections, ParseResources, ParseExports, ParseRelocations, ParseImports, ParseDelayImports,
+        PhaseCount
+    };
+    enum Counter { Probes, DirectoriesListed, FilesParsed, BytesMapped, Allocations, CounterCount };
+
+    // A span of the trace, times in nanoseconds since the trace started
+    struct Span {
+        Phase phase;
+        uint64_t startNs;
+        uint64_t durationNs;
+        // The file or module the span is for
+        string detail;
+    };
+
+    struct Track {
+        unsigned thread;
+        vector<Span> spans;
+    };
+
+    static inline bool enabled = false;
+    static inline bool tracing = false;
+
+    // Adds the time until the end of the scope to the phase, `detail` names the span in the trace
+    class Scope {
+    public:
+        explicit Scope(Phase phase, string_view detail = {}) : phase(phase), active(enabled) {
+            if (active) {
+                if (tracing) {
+                    this->detail = detail;
+                }
+                begin(phase);
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        ~Scope() {
+            if (active) {
+                end(phase, detail);
+            }
+        }
+
+    private:
+        Phase phase;
+        bool active;
+        string detail;
+    };
+
+    // Names the spans of the parse stages run until the end of the scope after the file being parsed
+    class FileScope {
+    public:
+        explicit FileScope(const string& file) : previous(currentFile) {
+            currentFile = &file;
+        }
+
+        FileScope(const FileScope&) = delete;
+        FileScope& operator=(const FileScope&) = delete;
+
+        ~FileScope() {
+            currentFile = previous;
+        }
+
+    private:
+        const string* previous;
+    };
+
+    static void add(Counter counter, uint64_t n = 1) {
+        if (enabled) {
+            counters[counter].fetch_add(n, memory_order_relaxed);
+        }
+    }
+
+    static void enable() {
+        enabled = true;
+        SetStageHook(stageHook);
+        reset();
+    }
+
+    // Keeps the spans from now on, on one track per thread, the calling thread's comes first
+    static void startTrace() {
+        enable();
+        tracing = true;
+        traceStart = wallNow();
+        track();
+    }
+
+    // The tracks of all the threads that ran a timed scope, only safe to read when no other thread is in one
+    static const vector<unique_ptr<Track>>& tracks() {
+        return allTracks;
+    }
+
+    // Drops the tracks and their spans and starts the trace over, so that watch mode doesn't keep every
+    // earlier scan (and the tracks of the pools gone since). Same restriction as tracks().
+    static void restartTrace() {
+        {
+            lock_guard<mutex> lock(tracksLock);
+            allTracks.clear();
+            trackGeneration++;
+        }
+        traceStart = wallNow();
+        track();
+    }
+
+    static const char* phaseName(Phase phase) {
+        static const char* names[PhaseCount] = {
+            "resolve (DllSearchPath::find)", "list directories", "build graph (fillDependencies)", "walkDependencies", "report pass", "output", "copy",
+            "readFileToFileBuffer", "getHeader", "getSections", "getResources", "getExportTable", "getRelocations", "getImports", "getDelayImports",
+        };
+        return names[phase];
+    }
+
+    static void reset() {
+        for (auto& totals : phases) {
+            totals.wallNs = totals.cpuNs = totals.calls = 0;
+        }
+        for (auto& counter : counters) {
+            counter = 0;
+        }
+        faultsAtReset = pageFaults();
+    }
+
+    static void print(ostream& out) {
+        static const char* counterNames[CounterCount] = { "path probes", "directories listed", "files parsed", "bytes mapped", "heap allocations" };
+        out << left << setw(32) << "Phase" << right << setw(10) << "calls" << setw(12) << "wall ms" << setw(12) << "cpu ms" << '\n';
+        for (int i = 0; i < PhaseCount; i++) {
+            out << left << setw(32) << phaseName(Phase(i)) << right << setw(10) << phases[i].calls.load()
+                << setw(12) << fixed << setprecision(2) << phases[i].wallNs / 1e6 << setw(12) << phases[i].cpuNs / 1e6 << '\n';
+        }
+        for (int i = 0; i < CounterCount; i++) {
+            out << left << setw(32) << counterNames[i] << right << setw(10) << counters[i].load() << '\n';
+        }
+#ifndef _WIN32
+        out << left << setw(32) << "pages touched (page faults)" << right << setw(10) << pageFaults() - faultsAtReset << '\n';
+#endif
+        out << defaultfloat << setprecision(6);
+    }
+
+private:
+    struct Totals {
+        atomic<uint64_t> wallNs{ 0 };
+        atomic<uint64_t> cpuNs{ 0 };
+        atomic<uint64_t> calls{ 0 };
+    };
+
+    struct Start {
+        uint64_t wallNs;
+        uint64_t cpuNs;
+    };
+
+    static uint64_t wallNow() {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t cpuNow() {
+        timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+    }
+
+    static uint64_t pageFaults() {
+#ifdef _WIN32
+        return 0;
+#else
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_minflt + usage.ru_majflt;
+#endif
+    }
+
+    // The phases of one thread don't nest into themselves, so one start per phase is enough
+    static Start& start(Phase phase) {
+        thread_local Start starts[PhaseCount];
+        return starts[phase];
+    }
+
+    static void begin(Phase phase) {
+        start(phase) = Start{ wallNow(), cpuNow() };
+    }
+
+    static Track& track() {
+        thread_local Track* current = nullptr;
+        thread_local uint64_t generation = 0;
+        if (current == nullptr || generation != trackGeneration) {
+            lock_guard<mutex> lock(tracksLock);
+            allTracks.push_back(make_unique<Track>(Track{ unsigned(allTracks.size()), {} }));
+            current = allTracks.back().get();
+            generation = trackGeneration;
+        }
+        return *current;
+    }
+
+    static void end(Phase phase, const string& detail) {
+        auto& s = start(phase);
+        auto now = wallNow();
+        if (tracing) {
+            track().spans.push_back(Span{ phase, s.wallNs - traceStart, now - s.wallNs, detail });
+        }
+        phases[phase].wallNs.fetch_add(now - s.wallNs, memory_order_relaxed);
+        phases[phase].cpuNs.fetch_add(cpuNow() - s.cpuNs, memory_order_relaxed);
+        phases[phase].calls.fetch_add(1, memory_order_relaxed);
+    }
+
+    static void stageHook(const char* stage, bool ending) {
+        static const pair<const char*, Phase> stages[] = {
+            { "readFileToFileBuffer", MapFile }, { "getHeader", ParseHeader }, { "getSections", ParseSections },
+            { "getResources", ParseResources }, { "getExportTable", ParseExports }, { "getRelocations", ParseRelocations },
+            { "getImports", ParseImports }, { "getDelayImports", ParseDelayImports },
+        };
+        for (auto& s : stages) {
+            if (strcmp(s.first, stage) == 0) {
+                if (ending) {
+                    end(s.second, currentFile ? *currentFile : string());
+                }else{
+                    begin(s.second);
+                }
+                return;
+            }
+        }
+    }
+
+    static Totals phases[PhaseCount];
+    static atomic<uint64_t> counters[CounterCount];
+    static uint64_t faultsAtReset;
+    static uint64_t traceStart;
+    static mutex tracksLock;
+    static vector<unique_ptr<Track>> allTracks;
+    static atomic<uint64_t> trackGeneration;
+    static thread_local const string* currentFile;
+};
+
+Stats::Totals Stats::phases[PhaseCount];
+atomic<uint64_t> Stats::counters[CounterCount];
+uint64_t Stats::faultsAtReset = 0;
+uint64_t Stats::traceStart = 0;
+mutex Stats::tracksLock;
+vector<unique_ptr<Stats::Track>> Stats::allTracks;
+atomic<uint64_t> Stats::trackGeneration{ 1 };
+thread_local const string* Stats::currentFile = nullptr;
+
+void countAllocation() noexcept {
+    Stats::add(Stats::Allocations);
+}
+
+#define STATS_SCOPE(phase) Stats::Scope statsScope(Stats::phase)
+#define STATS_SCOPE_FOR(phase, detail) Stats::Scope statsScope(Stats::phase, detail)
+#define STATS_FILE(file) Stats::FileScope statsFile(file)
+#define STATS_ADD(counter, n) Stats::add(Stats::counter, n)
+#else
+#define STATS_SCOPE(phase)
+#define STATS_SCOPE_FOR(phase, detail)
+#define STATS_FILE(file)
+#define STATS_ADD(counter, n)
+#endif
+
+struct DllPath {
+    fs::path path;
+    enum { User, System, Missing } location;
+};
+
+string foldCase(string name) {
+    transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return tolower(c); });
+    return name;
+}
+
+// Finds DLLs the way the loader does (app directory, system directories, then PATH). Every directory
+// is listed only once, into a table from case-folded names to the actual names on disk. All the
+// lookups, including the ones that don't find anything, are answered from those tables, which also
+// gives the resolved files their correct case, on any host.
+class DllSearchPath {
+public:
+    // The system directories and the PATH of the machine wdeps runs on (none on hosts other than Windows)
+    DllSearchPath() : path(toPaths(getPathEnv())) {
+#ifdef _WIN32
+        systemDirectories = { systemDirectory(), windowsDirectory() };
+#endif
+    }
+
+    // Resolves against a Windows installation found under `sysroot` (a Windows drive, a Wine prefix's
+    // drive_c, ...), searching `pathList` instead of PATH
+    DllSearchPath(const fs::path& sysroot, const vector<string>& pathList) : path(toPaths(pathList)) {
+        auto windows = findEntry(sysroot, "windows");
+        if (!windows.empty()) {
+            auto system32 = findEntry(windows, "system32");
+            if (!system32.empty()) {
+                systemDirectories.push_back(system32);
+            }
+            systemDirectories.push_back(windows);
+        }
+    }
+
+    // Searches `pathList` instead of PATH, the system directories stay the host's own
+    explicit DllSearchPath(const vector<string>& pathList) : DllSearchPath() {
+        path = toPaths(pathList);
+    }
+
+    // One path tried while looking for a DLL, the first probe of a directory includes listing it
+    struct Probe {
+        fs::path directory;
+        // The file found, or the one that was looked for
+        fs::path file;
+        bool found;
+        chrono::nanoseconds time;
+    };
+
+    struct Lookup {
+        string dllName;
+        fs::path appDirectory;
+        DllPath result;
+        vector<Probe> probes;
+    };
+
+    // While probes are recorded and `deferred` is given, the lookup is left there instead of being recorded,
+    // for the lookups made ahead of time, which are only recorded once the graph uses them
+    DllPath find(const fs::path& appDirectory, const string& dllName, optional<Lookup>* deferred = nullptr) {
+        STATS_SCOPE_FOR(Resolve, dllName);
+        if (!recording) {
+            return search(appDirectory, dllName, nullptr);
+        }
+        Lookup lookup{ dllName, appDirectory, { dllName, DllPath::Missing }, {} };
+        lookup.result = search(appDirectory, dllName, &lookup);
+        auto result = lookup.result;
+        if (deferred) {
+            *deferred = move(lookup);
+        }else{
+            record(move(lookup));
+        }
+        return result;
+    }
+
+    void record(Lookup lookup) {
+        lock_guard<mutex> lock(lookupsLock);
+        lookups.push_back(move(lookup));
+    }
+
+    // Keeps every lookup made from now on, with the paths it probed
+    void recordProbes() {
+        recording = true;
+    }
+
+    // The lookups recorded since the last call
+    vector<Lookup> takeLookups() {
+        lock_guard<mutex> lock(lookupsLock);
+        return move(lookups);
+    }
+
+    // What a directory is to the search, PATH entries are numbered from 1
+    string describe(const fs::path& directory) const {
+        for (size_t i = 0; i < path.size(); i++) {
+            if (path[i] == directory) {
+                return "PATH entry " + to_string(i + 1);
+            }
+        }
+        if (find_if(systemDirectories.begin(), systemDirectories.end(), [&](const fs::path& s) { return s == directory; }) != systemDirectories.end()) {
+            return "system directory";
+        }
+        return "application directory";
+    }
+
+    // Every directory a DLL can be found in, besides the application directories
+    vector<fs::path> directories() const {
+        auto result = systemDirectories;
+        result.insert(result.end(), path.begin(), path.end());
+        return result;
+    }
+
+    // Lists the directory again on the next lookup, after its contents changed
+    void forget(const fs::path& directory) {
+        lock_guard<mutex> lock(indexLock);
+        indexes.erase(directory.string());
+    }
+
+private:
+    // Case-folded name -> name on disk
+    using Index = unordered_map<string, string>;
+
+    DllPath search(const fs::path& appDirectory, const string& dllName, Lookup* lookup) {
+        auto name = foldCase(dllName);
+        auto probe = [&](const fs::path& directory) {
+            if (lookup == nullptr) {
+                return findEntry(directory, name);
+            }
+            auto start = chrono::steady_clock::now();
+            auto file = findEntry(directory, name);
+            auto time = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+            lookup->probes.push_back(Probe{ directory, file.empty() ? directory / dllName : file, !file.empty(), time });
+            return file;
+        };
+
+        auto file = probe(appDirectory);
+        if (!file.empty()) {
+            return { file, DllPath::User };
+        }
+
+        for (auto& s : systemDirectories) {
+            file = probe(s);
+            if (!file.empty()) {
+                return { file, DllPath::System };
+            }
+        }
+
+        for (auto& s : path) {
+            file = probe(s);
+            if (!file.empty()) {
+                return { file, DllPath::User };
+            }
+        }
+
+        return { dllName, DllPath::Missing };
+    }
+
+    static vector<fs::path> toPaths(const vector<string>& list) {
+        return vector<fs::path>(list.begin(), list.end());
+    }
+
+    // Returns directory / (the entry with the given case-insensitive name), or an empty path if there's no such entry
+    fs::path findEntry(const fs::path& directory, const string& name) {
+        STATS_ADD(Probes, 1);
+        auto& entries = index(directory);
+        auto it = entries.find(foldCase(name));
+        return it != entries.end() ? directory / it->second : fs::path();
+    }
+
+    const Index& index(const fs::path& directory) {
+        auto key = directory.string();
+        {
+            lock_guard<mutex> lock(indexLock);
+            auto it = indexes.find(key);
+            if (it != indexes.end()) {
+                return *it->second;
+            }
+        }
+        // Listed outside of the lock, if two threads race here, the first one wins
+        STATS_SCOPE_FOR(ListDirectory, key);
+        STATS_ADD(DirectoriesListed, 1);
+        auto listed = make_unique<Index>();
+        boost::system::error_code error;
+        for (fs::directory_iterator it(directory.empty() ? "." : directory, error), end; !error && it != end; it.increment(error)) {
+            auto name = it->path().filename().string();
+            listed->emplace(foldCase(name), name);
+        }
+        lock_guard<mutex> lock(indexLock);
+        return *indexes.emplace(key, move(listed)).first->second;
+    }
+
+    vector<fs::path> systemDirectories;
+    vector<fs::path> path;
+    mutex indexLock;
+    unordered_map<string, unique_ptr<const Index>> indexes;
+    bool recording = false;
+    mutex lookupsLock;
+    vector<Lookup> lookups;
+};
+
+// Every imported module name seen so far, upper-cased and stored once for the rest of the run. Nearly
+// every file imports the same few names, so the import lists only keep views of these and a parse
+// doesn't allocate for its module names.
+class ModuleNames {
+public:
+    static string_view intern(string_view name) {
+        thread_local string upper;
+        upper.assign(name);
+        transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char c) { return toupper(c); });
+        {
+            shared_lock<shared_mutex> lock(namesLock);
+            auto it = names.find(upper);
+            if (it != names.end()) {
+                return *it;
+            }
+        }
+        lock_guard<shared_mutex> lock(namesLock);
+        auto it = names.find(upper);
+        if (it != names.end()) {
+            return *it;
+        }
+        // Deque elements don't move when more are added
+        return *names.insert(storage.emplace_back(upper)).first;
+    }
+
+private:
+    static inline shared_mutex namesLock;
+    static inline deque<string> storage;
+    static inline unordered_set<string_view> names;
+};
+
+// A symbol imported from a DLL, either by name or by ordinal
+struct ImportedSymbol {
+    string name;
+    // Where the name was in the exporter's name table when the importer was linked
+    uint16_t hint = 0;
+    bool byOrdinal = false;
+    uint16_t ordinal = 0;
+
+    string toString() const {
+        return byOrdinal ? "#" + to_string(ordinal) : name;
+    }
+};
+
+// What fillDependencies needs to know about a parsed file
+struct ImportInfo {
+    bool isValid = false;
+    bool stripped = false;
+    // Interned by ModuleNames, sorted and without duplicates
+    vector<string_view> modules;
+    // Loaded on first use instead of at startup, without the ones that are also in modules
+    vector<string_view> delayedModules;
+    // Whether the imported symbols were read too, only done when a report needs them
+    bool hasSymbols = false;
+    // By interned module name
+    map<string_view, vector<ImportedSymbol>> symbols;
+
+    void normalize() {
+        sort(modules.begin(), modules.end());
+        modules.erase(unique(modules.begin(), modules.end()), modules.end());
+        sort(delayedModules.begin(), delayedModules.end());
+        delayedModules.erase(unique(delayedModules.begin(), delayedModules.end()), delayedModules.end());
+        delayedModules.erase(remove_if(delayedModules.begin(), delayedModules.end(), [&](string_view m) {
+            return binary_search(modules.begin(), modules.end(), m);
+        }), delayedModules.end());
+    }
+};
+
+// Keeps recently parsed files mapped, so that the passes which come back to a file don't have to map
+// and parse it again. Caps how many files stay open and how many bytes stay mapped, unmapping the
+// least recently used files first. A file that a caller still holds stays mapped until it's released,
+// but no longer counts against the caps.
+class MappingPool {
+public:
+    MappingPool(size_t maxOpen, uint64_t maxBytes) : maxOpen(maxOpen), maxBytes(maxBytes) { }
+
+    // nullptr if the file can't be parsed
+    shared_ptr<parsed_pe> acquire(const fs::path& file, uint32_t stages) {
+        auto key = file.string();
+        {
+            lock_guard<mutex> lock(poolLock);
+            auto it = byKey.find(key);
+            if (it != byKey.end()) {
+                if ((it->second->stages & stages) == stages) {
+                    entries.splice(entries.begin(), entries, it->second);
+                    return it->second->pe;
+                }
+                // Parsed again below with both sets of stages, so that the entry stays useful to the earlier callers too
+                stages |= it->second->stages;
+            }
+        }
+
+        STATS_FILE(key);
+        auto parsed = ParsePE(key.c_str(), stages);
+        if (!parsed.pe) {
+            return nullptr;
+        }
+        shared_ptr<parsed_pe> pe(move(parsed.pe));
+        STATS_ADD(FilesParsed, 1);
+        STATS_ADD(BytesMapped, bufLen(pe->fileBuffer));
+
+        lock_guard<mutex> lock(poolLock);
+        auto it = byKey.find(key);
+        if (it != byKey.end()) {
+            remove(it->second);
+        }
+        entries.push_front(Entry{ key, stages, pe, bufLen(pe->fileBuffer) });
+        byKey[key] = entries.begin();
+        mappedBytes += entries.front().bytes;
+        trim();
+        return pe;
+    }
+
+    // Unmaps everything that isn't held by a caller, after files changed on disk
+    void clear() {
+        lock_guard<mutex> lock(poolLock);
+        while (!entries.empty()) {
+            remove(entries.begin());
+        }
+    }
+
+private:
+    struct Entry {
+        string key;
+        uint32_t stages;
+        shared_ptr<parsed_pe> pe;
+        uint64_t bytes;
+    };
+
+    void remove(list<Entry>::iterator entry) {
+        mappedBytes -= entry->bytes;
+        byKey.erase(entry->key);
+        entries.erase(entry);
+    }
+
+    void trim() {
+        while (!entries.empty() && (entries.size() > maxOpen || mappedBytes > maxBytes)) {
+            remove(prev(entries.end()));
+        }
+    }
+
+    size_t maxOpen;
+    uint64_t maxBytes;
+    uint64_t mappedBytes = 0;
+    mutex poolLock;
+    // Most recently used first
+    list<Entry> entries;
+    unordered_map<string, list<Entry>::iterator> byKey;
+};
+
+ImportInfo readImports(MappingPool& pool, const fs::path& file, bool withSymbols = false) {
+    ImportInfo info;
+    // Unless the symbols are asked for, only the imported module names are needed, so skip the rest of the parse stages
+    auto parsed = pool.acquire(file, withSymbols ? PARSE_IMPORTS : PARSE_IMPORT_MODULES);
+    if (parsed == nullptr) {
+        return info;
+    }
+    info.isValid = true;
+
+    // The names are views into the mapping, and once a name is interned, it's never copied again
+    info.modules.reserve(GetImportModules(parsed.get()).size());
+    ForEachImportModule(parsed.get(), [&](string_view name) {
+        info.modules.push_back(ModuleNames::intern(name));
+    });
+    auto delayError = GetDelayImportError(parsed.get());
+    if (delayError.code != PEERR_NONE) {
+        // One write, so that the lines of parallel parses don't interleave
+        cerr << ("Warning: ignoring the malformed delay-load import table of " + file.string() + " (" + GetPEErrString(delayError) + ")\n") << flush;
+    }
+    info.delayedModules.reserve(GetDelayImportModules(parsed.get()).size());
+    ForEachDelayImportModule(parsed.get(), [&](string_view name) {
+        info.delayedModules.push_back(ModuleNames::intern(name));
+    });
+    if (withSymbols) {
+        info.hasSymbols = true;
+        ForEachImport(parsed.get(), [&](const import_ref& ref) {
+            info.symbols[ModuleNames::intern(ref.moduleName)].push_back({ string(ref.symbolName), ref.hint, ref.byOrdinal, ref.ordinal });
+        });
+    }
+    info.normalize();
+    auto& c = parsed->peHeader.nt.FileHeader.Characteristics;
+    if ((c & IMAGE_FILE_DEBUG_STRIPPED) && (c & IMAGE_FILE_LINE_NUMS_STRIPPED) && (c & IMAGE_FILE_LOCAL_SYMS_STRIPPED)) {
+        info.stripped = true;
+    }
+    return info;
+}
+
+// On-disk cache of readImports() results, so that files which didn't change since the last run
+// don't have to be parsed again. Each file gets one small text entry, named after a hash of its path
+// and validated against the path, size, modification time and inode recorded inside it.
+class ImportCache {
+public:
+    ImportCache(fs::path directory, uintmax_t maxBytes) : directory(move(directory)), maxBytes(maxBytes) {
+        fs::create_directories(this->directory);
+    }
+
+    optional<ImportInfo> load(const fs::path& file) const {
+        auto key = keyFor(file);
+        if (!key) {
+            return {};
+        }
+        auto entry = entryPath(*key);
+        ifstream in(entry.string(), ios::binary);
+        string magic, path, stamp, flags;
+        if (!getline(in, magic) || magic != cacheMagic ||
+            !getline(in, path) || path != key->path ||
+            !getline(in, stamp) || stamp != key->stamp ||
+            !getline(in, flags) || flags.size() != 3) {
+            return {};
+        }
+        ImportInfo info;
+        info.isValid = flags[0] == 'V';
+        info.stripped = flags[1] == 'S';
+        info.hasSymbols = flags[2] == 'Y';
+        // "S name" for a module imported at startup, "D name" for a delay-loaded one,
+        // "F name<tab>hint<tab>symbol" for a symbol imported by name, "O name<tab>ordinal" for one imported by ordinal
+        string line;
+        while (getline(in, line)) {
+            if (line.size() < 3 || line[1] != ' ') {
+                return {};
+            }
+            if (line[0] == 'F' || line[0] == 'O') {
+                auto tab = line.find('\t', 2);
+                if (tab == string::npos) {
+                    return {};
+                }
+                ImportedSymbol symbol;
+                char* end;
+                auto number = uint16_t(strtoul(line.c_str() + tab + 1, &end, 10));
+                if (line[0] == 'O') {
+                    symbol.byOrdinal = true;
+                    symbol.ordinal = number;
+                }else if (*end == '\t') {
+                    symbol.hint = number;
+                    symbol.name = end + 1;
+                }else{
+                    return {};
+                }
+                info.symbols[ModuleNames::intern(string_view(line).substr(2, tab - 2))].push_back(move(symbol));
+            }else if (line[0] == 'S' || line[0] == 'D') {
+                (line[0] == 'S' ? info.modules : info.delayedModules).push_back(ModuleNames::intern(string_view(line).substr(2)));
+            }else{
+                return {};
+            }
+        }
+        info.normalize();
+        in.close();
+
+        // Entries are evicted least recently used first
+        boost::system::error_code ignored;
+        fs::last_write_time(entry, time(nullptr), ignored);
+        return info;
+    }
+
+    void store(const fs::path& file, const ImportInfo& info) const {
+        auto key = keyFor(file);
+        if (!key) {
+            return;
+        }
+        // Written under a temporary name and renamed, so that a concurrent run never sees half an entry
+        auto entry = entryPath(*key);
+        auto temporary = fs::path(entry).concat(".tmp" + to_string(currentProcessId()) + "-" + to_string(hash<thread::id>()(this_thread::get_id())));
+        {
+            ofstream out(temporary.string(), ios::binary | ios::trunc);
+            out << cacheMagic << '\n' << key->path << '\n' << key->stamp << '\n';
+            out << (info.isValid ? 'V' : 'I') << (info.stripped ? 'S' : 'U') << (info.hasSymbols ? 'Y' : 'N') << '\n';
+            for (auto& module : info.modules) {
+                out << "S " << module << '\n';
+            }
+            for (auto& module : info.delayedModules) {
+                out << "D " << module << '\n';
+            }
+            for (auto& [module, symbols] : info.symbols) {
+                for (auto& symbol : symbols) {
+                    if (symbol.byOrdinal) {
+                        out << "O " << module << '\t' << symbol.ordinal << '\n';
+                    }else{
+                        out << "F " << module << '\t' << symbol.hint << '\t' << symbol.name << '\n';
+                    }
+                }
+            }
+            if (!out) {
+                return;
+            }
+        }
+        boost::system::error_code error;
+        fs::rename(temporary, entry, error);
+        if (error) {
+            fs::remove(temporary, error);
+        }
+    }
+
+    // Removes the least recently used entries until the cache fits into maxBytes
+    void evict() const {
+        vector<pair<time_t, fs::path>> entries;
+        uintmax_t total = 0;
+        boost::system::error_code error;
+        for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+            if (it->path().extension() != entryExtension) {
+                continue;
+            }
+            boost::system::error_code fileError;
+            auto size = fs::file_size(it->path(), fileError);
+            auto modified = fs::last_write_time(it->path(), fileError);
+            if (fileError) {
+                continue;
+            }
+            total += size;
+            entries.emplace_back(modified, it->path());
+        }
+        sort(entries.begin(), entries.end());
+        for (auto& entry : entries) {
+            if (total <= maxBytes) {
+                break;
+            }
+            boost::system::error_code fileError;
+            auto size = fs::file_size(entry.second, fileError);
+            if (!fileError && fs::remove(entry.second, fileError)) {
+                total -= size;
+            }
+        }
+    }
+
+private:
+    struct Key {
+        string path;
+        string stamp;
+    };
+
+    static optional<Key> keyFor(const fs::path& file) {
+        auto absolute = fs::absolute(file).lexically_normal();
+        struct stat status;
+        if (stat(absolute.string().c_str(), &status) != 0) {
+            return {};
+        }
+        // A rebuilt DLL is often padded to the same size and written within the same second,
+        // so the sub-second times and the change time are part of the stamp too
+        stringstream stamp;
+        stamp << status.st_size << ' ' << status.st_mtime << ' ' << status.st_ino << ' ' << status.st_ctime;
+#ifndef _WIN32
+        stamp << ' ' << status.st_mtim.tv_nsec << ' ' << status.st_ctim.tv_nsec;
+#endif
+        return Key{ absolute.string(), stamp.str() };
+    }
+
+    // Thread ids are only unique within one process, and several runs can share the cache directory
+    static long currentProcessId() {
+#ifdef _WIN32
+        return _getpid();
+#else
+        return getpid();
+#endif
+    }
+
+    fs::path entryPath(const Key& key) const {
+        // FNV-1a, only used to spread the entries, collisions are caught by comparing the path
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : key.path) {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        stringstream name;
+        name << hex << setw(16) << setfill('0') << hash << entryExtension;
+        return directory / name.str();
+    }
+
+    static constexpr const char* cacheMagic = "wdeps-import-cache 5";
+    static constexpr const char* entryExtension = ".imports";
+
+    fs::path directory;
+    uintmax_t maxBytes;
+};
+
+// A fixed set of worker threads, each with its own task deque. A worker pushes and pops new tasks
+// at the back of its own deque, and when it runs dry, steals from the front of the other ones.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threadCount) {
+        for (unsigned i = 0; i < threadCount; i++) {
+            queues.push_back(make_unique<Queue>());
+        }
+        for (unsigned i = 0; i < threadCount; i++) {
+            workers.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> lock(stateLock);
+            stopping = true;
+        }
+        wakeWorkers.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Tasks submitted from a worker go to that worker's own deque
+    void submit(function<void()> task) {
+        unsigned target = currentPool == this ? currentWorker : nextQueue++ % queues.size();
+        pending++;
+        {
+            lock_guard<mutex> lock(queues[target]->lock);
+            queues[target]->tasks.push_back(move(task));
+        }
+        {
+            lock_guard<mutex> lock(stateLock);
+            queued++;
+        }
+        wakeWorkers.notify_one();
+    }
+
+    // Blocks until all submitted tasks, including the ones they submitted, have finished
+    void wait() {
+        unique_lock<mutex> lock(stateLock);
+        allDone.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    struct Queue {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    bool tryTake(unsigned self, function<void()>& task) {
+        for (size_t i = 0; i < queues.size(); i++) {
+            auto& queue = *queues[(self + i) % queues.size()];
+            lock_guard<mutex> lock(queue.lock);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                task = move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }else{
+                task = move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void run(unsigned self) {
+        currentPool = this;
+        currentWorker = self;
+        while (true) {
+            {
+                unique_lock<mutex> lock(stateLock);
+                wakeWorkers.wait(lock, [this] { return stopping || queued > 0; });
+                if (stopping) { return; }
+            }
+            function<void()> task;
+            if (!tryTake(self, task)) {
+                continue;
+            }
+            {
+                lock_guard<mutex> lock(stateLock);
+                queued--;
+            }
+            task();
+            if (--pending == 0) {
+                lock_guard<mutex> lock(stateLock);
+                allDone.notify_all();
+            }
+        }
+    }
+
+    vector<unique_ptr<Queue>> queues;
+    vector<thread> workers;
+    atomic<size_t> pending{0};
+    atomic<unsigned> nextQueue{0};
+    mutex stateLock;
+    condition_variable wakeWorkers;
+    condition_variable allDone;
+    size_t queued = 0;
+    bool stopping = false;
+    // The pool and the deque of the worker running on this thread, a task may submit to another pool
+    static thread_local const WorkStealingPool* currentPool;
+    static thread_local unsigned currentWorker;
+};
+
+thread_local const WorkStealingPool* WorkStealingPool::currentPool = nullptr;
+thread_local unsigned WorkStealingPool::currentWorker = 0;
+
+// Answers the path lookups and parses that fillDependencies makes. With more than one job, prefetch()
+// does all of them ahead of time on a thread pool, so fillDependencies itself just reads the results
+// and builds the same graph as the serial run.
+class Scanner {
+public:
+    Scanner(DllSearchPath& searchPath, MappingPool& mappings, unsigned jobs = 1, const ImportCache* cache = nullptr, bool withSymbols = false)
+        : searchPath(searchPath), mappings(mappings), jobs(jobs), cache(cache), withSymbols(withSymbols) { }
+
+    void prefetch(const vector<DllPath>& roots, bool recurseIntoSystem) {
+        if (jobs <= 1) {
+            return;
+        }
+        WorkStealingPool pool(jobs);
+        function<void(const DllPath&)> parse = [&](const DllPath& dll) {
+            if (dll.location == DllPath::Missing || (dll.location == DllPath::System && !recurseIntoSystem)) {
+                return;
+            }
+            if (!claim(parsedKeys, fileKey(dll.path))) {
+                return;
+            }
+            auto info = make_shared<const ImportInfo>(load(dll.path));
+            auto directory = dll.path.parent_path();
+            {
+                lock_guard<mutex> lock(memoLock);
+                parsed.emplace(fileKey(dll.path), info);
+            }
+            for (auto* modules : { &info->modules, &info->delayedModules }) {
+                for (auto& module : *modules) {
+                    pool.submit([&, directory, module] {
+                        // The graph has one node per module name, found from the directory of its first
+                        // importer, so one lookup per name is enough (when another importer's directory
+                        // would find a different file, the serial pass looks that one up itself)
+                        if (!claim(prefetchedNames, foldCase(string(module)))) {
+                            return;
+                        }
+                        try {
+                            optional<DllSearchPath::Lookup> lookup;
+                            auto dllPath = searchPath.find(directory, string(module), &lookup);
+                            {
+                                lock_guard<mutex> lock(memoLock);
+                                resolved.emplace(resolveKey(directory, module), dllPath);
+                                if (lookup) {
+                                    unusedLookups.emplace(resolveKey(directory, module), move(*lookup));
+                                }
+                            }
+                            parse(dllPath);
+                        }catch(exception&) {
+                            // Left for the serial pass to run into again and report the same way it always has
+                        }
+                    });
+                }
+            }
+        };
+        for (auto& root : roots) {
+            pool.submit([&] {
+                try {
+                    parse(root);
+                }catch(exception&) {
+                    // Same as for the dependencies, the serial pass reports it
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    DllPath resolve(const fs::path& directory, string_view dllName) {
+        auto key = resolveKey(directory, dllName);
+        {
+            unique_lock<mutex> lock(memoLock);
+            auto it = resolved.find(key);
+            if (it != resolved.end()) {
+                auto result = it->second;
+                // A prefetched lookup is only reported once the graph uses it, like with one job
+                auto unused = unusedLookups.find(key);
+                if (unused != unusedLookups.end()) {
+                    auto lookup = move(unused->second);
+                    unusedLookups.erase(unused);
+                    lock.unlock();
+                    searchPath.record(move(lookup));
+                }
+                return result;
+            }
+        }
+        auto dllPath = searchPath.find(directory, string(dllName));
+        lock_guard<mutex> lock(memoLock);
+        return resolved.emplace(key, dllPath).first->second;
+    }
+
+    // Every file is parsed at most once, even when several inputs or import names lead to it
+    shared_ptr<const ImportInfo> imports(const fs::path& file) {
+        auto key = fileKey(file);
+        {
+            lock_guard<mutex> lock(memoLock);
+            auto it = parsed.find(key);
+            if (it != parsed.end()) {
+                return it->second;
+            }
+        }
+        auto info = make_shared<const ImportInfo>(load(file));
+        lock_guard<mutex> lock(memoLock);
+        return parsed.emplace(key, info).first->second;
+    }
+
+    // Whether both paths lead to the same file, as far as the memoization is concerned
+    bool sameFile(const fs::path& a, const fs::path& b) const {
+        return fileKey(a) == fileKey(b);
+    }
+
+    // Forgets the parse of file, and where every DLL with the same name was found, so that both are
+    // looked up again after the file changed, appeared or went away
+    void forget(const fs::path& file) {
+        auto name = foldCase(file.filename().string());
+        lock_guard<mutex> lock(memoLock);
+        parsed.erase(fileKey(file));
+        parsedKeys.erase(fileKey(file));
+        auto sameName = [&](const string& key) { return foldCase(key.substr(key.find('\0') + 1)) == name; };
+        for (auto it = resolved.begin(); it != resolved.end();) {
+            it = sameName(it->first) ? resolved.erase(it) : next(it);
+        }
+        for (auto it = unusedLookups.begin(); it != unusedLookups.end();) {
+            it = sameName(it->first) ? unusedLookups.erase(it) : next(it);
+        }
+        prefetchedNames.erase(name);
+    }
+
+private:
+    ImportInfo load(const fs::path& file) {
+        if (cache) {
+            auto cached = cache->load(file);
+            if (cached && (cached->hasSymbols || !withSymbols)) {
+                return *cached;
+            }
+        }
+        auto info = readImports(mappings, file, withSymbols);
+        if (cache) {
+            cache->store(file, info);
+        }
+        return info;
+    }
+
+    static string resolveKey(const fs::path& directory, string_view dllName) {
+        return (directory.string() + '\0').append(dllName);
+    }
+
+    // The absolute, normalized and case-folded path, current_path() is only queried once
+    string fileKey(const fs::path& file) const {
+        return foldCase((file.is_absolute() ? file : workingDirectory / file).lexically_normal().string());
+    }
+
+    // Returns true for the first caller with the given key, so that every lookup is done only once
+    bool claim(set<string>& keys, const string& key) {
+        lock_guard<mutex> lock(memoLock);
+        return keys.insert(key).second;
+    }
+
+    DllSearchPath& searchPath;
+    MappingPool& mappings;
+    unsigned jobs;
+    const ImportCache* cache;
+    bool withSymbols;
+    fs::path workingDirectory = fs::current_path();
+    mutex memoLock;
+    // Case-folded
+    set<string> prefetchedNames;
+    set<string> parsedKeys;
+    unordered_map<string, DllPath> resolved;
+    // Made by prefetch() while probes are recorded, by resolveKey, until resolve() returns them
+    unordered_map<string, DllSearchPath::Lookup> unusedLookups;
+    unordered_map<string, shared_ptr<const ImportInfo>> parsed;
+};
+
+struct Dll;
+
+// An edge of the dependency graph
+struct Dependency {
+    Dll* dll;
+    // Loaded on the first call into it, rather than when the process starts
+    bool delayed;
+    // The symbols imported through this edge, only filled in when the Scanner reads them
+    vector<ImportedSymbol> symbols;
+};
+
+struct Dll {
+    explicit Dll(DllPath path) : path(move(path)) { }
+
+    DllPath path;
+    // This gets mutated during fillDependencies
+    bool isValid = true;
+    bool stripped = false;
+    vector<Dependency> dependencies;
+    mutable bool sizeKnown = false;
+    mutable optional<uint64_t> size;
+
+    bool isSystem() const { return path.location == DllPath::System; }
+
+    // Nothing for missing files and the ones that can't be read, looked up once unless a snapshot set it
+    optional<uint64_t> fileSize() const {
+        if (!sizeKnown && path.location != DllPath::Missing) {
+            boost::system::error_code fileError;
+            auto fileSize = fs::file_size(path.path, fileError);
+            if (!fileError) {
+                size = fileSize;
+            }
+        }
+        sizeKnown = true;
+        return size;
+    }
+
+    void fillDependencies(map<string, unique_ptr<Dll>, less<>>& globalMap, Scanner& scanner, bool recurseIntoSystem = false) {
+        if (path.location == DllPath::Missing || (path.location == DllPath::System && !recurseIntoSystem)) {
+            return;
+        }
+        auto directory = path.path.parent_path();
+        auto info = scanner.imports(path.path);
+        if (!info->isValid) {
+            isValid = false;
+            return;
+        }
+
+        stripped = info->stripped;
+        auto add = [&](string_view s, bool delayed) {
+            auto symbols = info->symbols.find(s);
+            Dependency edge{ nullptr, delayed, symbols != info->symbols.end() ? symbols->second : vector<ImportedSymbol>() };
+            auto known = globalMap.find(s);
+            if (known != globalMap.end()) {
+                edge.dll = known->second.get();
+                dependencies.push_back(move(edge));
+                return;
+            }
+            auto dllPath = scanner.resolve(directory, s);
+            auto& result = globalMap.emplace(string(s), make_unique<Dll>(move(dllPath))).first->second;
+            edge.dll = result.get();
+            dependencies.push_back(move(edge));
+            result->fillDependencies(globalMap, scanner, recurseIntoSystem);
+        };
+        for (auto& s : info->modules) {
+            add(s, false);
+        }
+        for (auto& s : info->delayedModules) {
+            add(s, true);
+        }
+    }
+
+    string toString(bool showPath = true) const {
+        switch (path.location) {
+            case DllPath::Missing: return path.path.string() + " (MISSING)";
+            case DllPath::User: return path.path.filename().string() + (isValid ? "" : " (INVALID!)") + (showPath ? " (" + path.path.string() + ")" : "");
+            case DllPath::System: return path.path.filename().string() + "(SYSTEM)" + (showPath ? " (" + path.path.string() + ")" : "");
+        }
+    }
+};
+
+using uint = unsigned int;
+void doWalkDependencies(
+    const Dll& dll,
+    set<const Dll*>& visited,
+    const function<void(const Dll&, bool wasVisited, uint level)>& action,
+    const function<bool(const Dll&, bool wasVisited, uint level)>& recurseFilter,
+    uint level,
+    bool staticOnly
+) {
+    visited.insert(&dll);
+    for (auto& edge : dll.dependencies) {
+        if (staticOnly && edge.delayed) {
+            continue;
+        }
+        auto* dependency = edge.dll;
+        bool wasVisited = visited.count(dependency) > 0;
+        action(*dependency, wasVisited, level);
+        if (!wasVisited && (!recurseFilter || recurseFilter(*dependency, wasVisited, level))) {
+            doWalkDependencies(*dependency, visited, action, recurseFilter, level + 1, staticOnly);
+        }
+    }
+}
+
+void walkDependencies(
+    const Dll& dll,
+    const function<void(const Dll&, bool wasVisited, uint level)>& action,
+    bool visitRoot = false,
+    const function<bool(const Dll&, bool wasVisited, uint level)>& recurseFilter = {},
+    bool staticOnly = false
+) {
+    STATS_SCOPE_FOR(Walk, dll.path.path.filename().string());
+    if (visitRoot) {
+        action(dll, false, 0);
+    }
+    set<const Dll*> visitedSet;
+    doWalkDependencies(dll, visitedSet, action, recurseFilter, 1, staticOnly);
+}
+
+// The DLLs that get loaded together with dll when the process starts, including dll itself
+set<const Dll*> startupClosure(const Dll& dll) {
+    set<const Dll*> closure;
+    walkDependencies(dll, [&](const Dll& dependency, bool wasVisited, uint level) {
+        closure.insert(&dependency);
+    }, true, {}, true);
+    return closure;
+}
+
+void dumpDependenciesTree(
+    const Dll& dll,
+    bool visitRoot = true,
+    bool showPath = true,
+    const function<bool(const Dll&, bool wasDumped, uint level)>& printFilter = {},
+    const function<bool(const Dll&, bool wasDumped, uint level)>& recurseFilter = {},
+    bool startupOnly = false
+) {
+    auto startup = startupClosure(dll);
+    walkDependencies(dll, [&](const Dll& dependency, bool wasVisited, uint level) {
+        string indent(level * 4, ' ');
+        if (!printFilter || printFilter(dependency, wasVisited, level)) {
+            cout << indent << dependency.toString(showPath) << (startup.count(&dependency) ? "" : " (DELAYED)") << (wasVisited ? " (+)" : "") << '\n';
+        }
+    }, visitRoot, recurseFilter, startupOnly);
+}
+
+void dumpDependenciesFlat(
+    const Dll& dll,
+    bool visitRoot = true,
+    const function<bool(const Dll&, bool wasDumped, uint level)>& printFilter = {},
+    const function<bool(const Dll&, bool wasDumped, uint level)>& recurseFilter = {}
+) {
+    walkDependencies(dll, [&](const Dll& dependency, bool wasVisited, uint level) {
+        string indent = (level > 0 && visitRoot ? "    " : "");
+        if (!printFilter || printFilter(dependency, wasVisited, level)) {
+            cout << indent << dependency.toString() << (wasVisited ? " (+ more, see above)" : "") << '\n';
+        }
+    }, visitRoot, recurseFilter);
+}
+
+void dumpFlatNonSystemDependencies(const Dll& dll) {
+    dumpDependenciesFlat(
+        dll,
+        true,
+        [](const Dll& dep, bool dumped, uint level) { return !dumped && dep.path.location != DllPath::System; }
+    );
+}
+
+void dumpTreeNonSystemDependencies(const Dll& dll) {
+    dumpDependenciesFlat(
+        dll,
+        true,
+        [](const Dll& dep, bool dumped, uint level) { return !dumped && dep.path.location != DllPath::System; }
+    );
+}
+
+string formatFileSize(size_t size) {
+    stringstream ss;
+    if (size < 1024) { ss << size << "B"; }
+    else if (size < 1024*1024) { ss << setprecision(2) << fixed << size/1024.0 << "kB"; }
+    else ss << setprecision(2) << fixed << size/(1024.0*1024.0) << "MB";
+    return ss.str();
+}
+
+string formatDuration(chrono::nanoseconds time) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.3f ms", time.count() / 1e6);
+    return text;
+}
+
+// Every lookup made since the last call with the paths it probed, then the search directories ranked
+// by the time spent probing them (a directory's first probe includes listing it)
+void printProbeInfo(DllSearchPath& searchPath) {
+    auto lookups = searchPath.takeLookups();
+    sort(lookups.begin(), lookups.end(), [](const DllSearchPath::Lookup& a, const DllSearchPath::Lookup& b) {
+        return a.dllName != b.dllName ? a.dllName < b.dllName : a.appDirectory < b.appDirectory;
+    });
+
+    struct Cost {
+        fs::path directory;
+        size_t probes = 0;
+        size_t found = 0;
+        chrono::nanoseconds time{ 0 };
+    };
+    unordered_map<string, Cost> costs;
+    cout << lookups.size() << " module lookups:\n";
+    for (auto& lookup : lookups) {
+        chrono::nanoseconds total{ 0 };
+        for (auto& probe : lookup.probes) {
+            total += probe.time;
+            auto& cost = costs[probe.directory.string()];
+            cost.directory = probe.directory;
+            cost.probes++;
+            cost.found += probe.found;
+            cost.time += probe.time;
+        }
+        cout << "    " << lookup.dllName << " from " << lookup.appDirectory.string() << ": ";
+        switch (lookup.result.location) {
+            case DllPath::Missing: cout << "MISSING"; break;
+            case DllPath::User: cout << lookup.result.path.string(); break;
+            case DllPath::System: cout << lookup.result.path.string() << " (SYSTEM)"; break;
+        }
+        cout << ", " << lookup.probes.size() << " probes, " << formatDuration(total) << '\n';
+        for (auto& probe : lookup.probes) {
+            cout << "        " << (probe.found ? "found " : "missed ") << probe.file.string() << " (" << formatDuration(probe.time) << ")\n";
+        }
+    }
+
+    vector<Cost> ranking;
+    for (auto& cost : costs) {
+        ranking.push_back(cost.second);
+    }
+    sort(ranking.begin(), ranking.end(), [](const Cost& a, const Cost& b) {
+        return a.time != b.time ? a.time > b.time : a.directory < b.directory;
+    });
+    cout << "\nSearch directories by probe cost:\n";
+    for (auto& cost : ranking) {
+        cout << "    " << cost.directory.string() << " (" << searchPath.describe(cost.directory) << "): " << formatDuration(cost.time) << ", "
+            << cost.probes << " probes, " << cost.found << " found\n";
+    }
+}
+
+void printSizeInfo(const Dll& dll, bool includeSystem = false, bool showPath = false, bool visitRoot = true, bool startupOnly = false) {
+    size_t total = 0;
+    size_t delayedTotal = 0;
+    bool anyUnstripped = false;
+    auto startup = startupClosure(dll);
+    walkDependencies(dll, [&](const Dll& dependency, bool wasVisited, uint level) {
+        if ((dependency.isSystem() && !includeSystem) || wasVisited) { return; }
+
+        auto fileSize = dependency.fileSize();
+        if (fileSize) {
+            total += *fileSize;
+        }
+        bool delayed = !startup.count(&dependency);
+        if (delayed && fileSize) {
+            delayedTotal += *fileSize;
+        }
+
+        string indent = (level > 0 && visitRoot ? "    " : "");
+        string size = fileSize ? formatFileSize(*fileSize) : "ERROR";
+        if (!dependency.stripped) { anyUnstripped = true; }
+        cout <<
+            indent <<
+            dependency.path.path.filename().string() <<
+            " (" << size << ")" <<
+            (dependency.isSystem() ? " (SYSTEM)" : "") <<
+            ((dependency.stripped || dependency.isSystem()) ? "" : "*") <<
+            (delayed ? " (DELAYED)" : "") <<
+            (showPath ? " (" + dependency.path.path.string() + ")" : "") <<
+            '\n';
+    }, visitRoot, {}, startupOnly);
+    cout << '\n';
+    cout << "Total: " << formatFileSize(total) << '\n';
+    if (delayedTotal > 0) {
+        cout << "Loaded at startup: " << formatFileSize(total - delayedTotal) << ", files marked with (DELAYED) are only loaded on first use.\n";
+    }
+    if (anyUnstripped) {
+        cout << "Files marked with * can be further stripped.\n";
+    }
+}
+
+// Where a non-system image wants to be loaded, and how much work it is to move it elsewhere
+struct ImageRange {
+    const Dll* dll;
+    uint64_t base;
+    uint64_t size;
+    size_t relocations;
+    bool relocationsStripped;
+
+    bool overlaps(const ImageRange& other) const {
+        return base < other.base + other.size && other.base < base + size;
+    }
+};
+
+optional<ImageRange> imageRangeOf(const Dll& dll, MappingPool& pool) {
+    auto pe = pool.acquire(dll.path.path, PARSE_RELOCATIONS);
+    if (pe == nullptr) {
+        return {};
+    }
+    auto& nt = pe->peHeader.nt;
+    ImageRange range{ &dll, 0, 0, 0, (nt.FileHeader.Characteristics & IMAGE_FILE_RELOCS_STRIPPED) != 0 };
+    if (nt.OptionalMagic == NT_OPTIONAL_32_MAGIC) {
+        range.base = nt.OptionalHeader.ImageBase;
+        range.size = nt.OptionalHeader.SizeOfImage;
+    }else{
+        range.base = nt.OptionalHeader64.ImageBase;
+        range.size = nt.OptionalHeader64.SizeOfImage;
+    }
+    IterRelocs(pe.get(), [](void* N, VA, reloc_type type) {
+        // ABSOLUTE (0) entries only pad the blocks, the loader skips them. Not spelled by name,
+        // because <wingdi.h> defines ABSOLUTE as a macro with a different value.
+        if (type != reloc_type(0)) {
+            ++*reinterpret_cast<size_t*>(N);
+        }
+        return 0;
+    }, &range.relocations);
+    return range;
+}
+
+// Lists the non-system images that can't be loaded at their preferred ImageBase because an image
+// loaded before them already occupies part of the range, most expensive to relocate first. Images are
+// placed in the order the loader would map them: the startup closure first, then the delay-loaded ones.
+void printRebaseInfo(const Dll& dll, MappingPool& pool, bool showPath = false) {
+    vector<const Dll*> order;
+    set<const Dll*> seen;
+    auto add = [&](const Dll& dependency, bool wasVisited, uint level) {
+        if (!dependency.isSystem() && dependency.path.location != DllPath::Missing && dependency.isValid && seen.insert(&dependency).second) {
+            order.push_back(&dependency);
+        }
+    };
+    walkDependencies(dll, add, true, {}, true);
+    walkDependencies(dll, add, true);
+
+    struct Rebase {
+        ImageRange range;
+        vector<const Dll*> collisions;
+    };
+    vector<ImageRange> placed;
+    vector<Rebase> rebased;
+    for (auto* image : order) {
+        auto range = imageRangeOf(*image, pool);
+        if (!range) {
+            continue;
+        }
+        Rebase rebase{ *range, {} };
+        for (auto& other : placed) {
+            if (range->overlaps(other)) {
+                rebase.collisions.push_back(other.dll);
+            }
+        }
+        if (rebase.collisions.empty()) {
+            placed.push_back(*range);
+        }else{
+            rebased.push_back(move(rebase));
+        }
+    }
+
+    stable_sort(rebased.begin(), rebased.end(), [](const Rebase& a, const Rebase& b) {
+        return a.range.relocations > b.range.relocations;
+    });
+    auto name = dll.path.path.filename().string();
+    if (rebased.empty()) {
+        cout << name << ": no image base collisions.\n";
+        return;
+    }
+    size_t total = 0;
+    for (auto& rebase : rebased) {
+        total += rebase.range.relocations;
+    }
+    cout << name << ": " << rebased.size() << " files rebased at load, " << total << " relocations to apply:\n";
+    for (auto& rebase : rebased) {
+        auto& range = rebase.range;
+        cout << "    " << range.dll->path.path.filename().string() << " (";
+        if (range.relocationsStripped) {
+            cout << "NO RELOCATIONS, can't be rebased";
+        }else{
+            cout << range.relocations << " relocations";
+        }
+        cout << ") at 0x" << hex << range.base << "-0x" << range.base + range.size << dec << " overlaps ";
+        for (size_t i = 0; i < rebase.collisions.size(); i++) {
+            cout << (i > 0 ? ", " : "") << rebase.collisions[i]->path.path.filename().string();
+        }
+        cout << (showPath ? " (" + range.dll->path.path.string() + ")" : "") << '\n';
+    }
+}
+
+// For every file in the graph, lists how many symbols it imports from each of its dependencies. The static
+// imports used for only a few symbols are the ones worth delay-loading (or, for non-system DLLs, linking
+// statically), since the whole DLL is loaded at startup for them.
+void printUsageInfo(const Dll& dll, bool includeSystem, size_t fewSymbols) {
+    vector<pair<const Dll*, const Dependency*>> candidates;
+    walkDependencies(dll, [&](const Dll& importer, bool wasVisited, uint level) {
+        if (wasVisited) { return; }
+        bool first = true;
+        for (auto& edge : importer.dependencies) {
+            if (edge.dll->isSystem() && !includeSystem) { continue; }
+            if (first) {
+                cout << importer.path.path.filename().string() << '\n';
+                first = false;
+            }
+            bool candidate = !edge.delayed && edge.symbols.size() <= fewSymbols;
+            cout << "    " << edge.dll->path.path.filename().string() << (edge.dll->isSystem() ? " (SYSTEM)" : "") << ": " << edge.symbols.size();
+            if (candidate) {
+                candidates.emplace_back(&importer, &edge);
+                cout << " (";
+                for (size_t i = 0; i < edge.symbols.size(); i++) {
+                    cout << (i > 0 ? ", " : "") << edge.symbols[i].toString();
+                }
+                cout << ")";
+            }
+            cout << (edge.delayed ? " (DELAYED)" : "") << (candidate ? " *" : "") << '\n';
+        }
+    }, true);
+    if (!candidates.empty()) {
+        cout << '\n';
+        cout << "Dependencies marked with * are used for at most " << fewSymbols << " symbols, consider delay-loading" <<
+            (includeSystem ? " or (except for system DLLs) statically linking them." : " or statically linking them.") << '\n';
+    }
+}
+
+// Why the loader can't bind a symbol, or nothing if it can. Forwarded exports are followed to the DLL
+// they name, looked up from the application directory like the loader does.
+optional<string> bindFailure(const DllPath& exporter, const ImportedSymbol& symbol, MappingPool& pool, Scanner& scanner, const fs::path& appDirectory, bool includeSystem, int depth = 0) {
+    if (exporter.location == DllPath::Missing) {
+        return " (forwarded to missing " + exporter.path.string() + ")";
+    }
+    if (exporter.location == DllPath::System && !includeSystem) {
+        return {};
+    }
+    auto pe = pool.acquire(exporter.path, PARSE_EXPORTS);
+    if (pe == nullptr) {
+        return " (" + exporter.path.filename().string() + " is invalid)";
+    }
+    // The import's hint is tried before the binary search of the export names, so on an unchanged DLL
+    // each lookup is a single comparison
+    export_ref found;
+    auto exports = GetExports(pe.get());
+    if (!(symbol.byOrdinal ? exports.findOrdinal(symbol.ordinal, found) : exports.find(symbol.name, found, symbol.hint))) {
+        return depth == 0 ? "" : " (not exported by " + exporter.path.filename().string() + ")";
+    }
+    if (!found.forwarded()) {
+        return {};
+    }
+
+    // "MODULE.Symbol" or "MODULE.#ordinal"
+    string forwarder(found.forwarder);
+    auto dot = forwarder.find('.');
+    if (dot == string::npos || depth >= 8) {
+        return " (bad forwarder " + forwarder + ")";
+    }
+    ImportedSymbol target;
+    if (forwarder[dot + 1] == '#') {
+        target.byOrdinal = true;
+        target.ordinal = uint16_t(strtoul(forwarder.c_str() + dot + 2, nullptr, 10));
+    }else{
+        target.name = forwarder.substr(dot + 1);
+    }
+    auto module = forwarder.substr(0, dot) + ".DLL";
+    transform(module.begin(), module.end(), module.begin(), ::toupper);
+    auto failure = bindFailure(scanner.resolve(appDirectory, module), target, pool, scanner, appDirectory, includeSystem, depth + 1);
+    if (failure && failure->empty()) {
+        return " (not exported by " + module + ")";
+    }
+    return failure;
+}
+
+// Binds every symbol imported from a DLL that was found against that DLL's exports, the way the loader
+// would, and lists the ones it can't bind.
+void printUnresolvedInfo(const Dll& dll, MappingPool& pool, Scanner& scanner, bool includeSystem) {
+    auto appDirectory = dll.path.path.parent_path();
+    size_t checked = 0;
+    size_t unresolved = 0;
+    walkDependencies(dll, [&](const Dll& importer, bool wasVisited, uint level) {
+        if (wasVisited) { return; }
+        for (auto& edge : importer.dependencies) {
+            auto& exporter = *edge.dll;
+            if (exporter.path.location == DllPath::Missing || (exporter.isSystem() && !includeSystem) || !exporter.isValid || edge.symbols.empty()) {
+                continue;
+            }
+            vector<string> missing;
+            for (auto& symbol : edge.symbols) {
+                if (auto failure = bindFailure(exporter.path, symbol, pool, scanner, appDirectory, includeSystem)) {
+                    missing.push_back(symbol.toString() + *failure);
+                }
+            }
+            checked += edge.symbols.size();
+            unresolved += missing.size();
+            if (missing.empty()) {
+                continue;
+            }
+            cout << "    " << importer.path.path.filename().string() << " -> " << exporter.path.path.filename().string() << (edge.delayed ? " (DELAYED)" : "") << ": ";
+            for (size_t i = 0; i < missing.size(); i++) {
+                cout << (i > 0 ? ", " : "") << missing[i];
+            }
+            cout << '\n';
+        }
+    }, true);
+    auto name = dll.path.path.filename().string();
+    if (unresolved == 0) {
+        cout << name << ": all " << checked << " imported symbols resolved.\n";
+    }else{
+        cout << '\n' << name << ": " << unresolved << " of " << checked << " imported symbols unresolved.\n";
+    }
+}
+
+// Collects output in a large buffer that only goes to the file when it fills up and at the end, instead of
+// flushing every line
+class BufferedWriter {
+public:
+    explicit BufferedWriter(FILE* file, size_t capacity = 4 * 1024 * 1024) : file(file) {
+        buffer.reserve(capacity);
+    }
+
+    ~BufferedWriter() {
+        flush();
+    }
+
+    BufferedWriter& operator<<(string_view s) {
+        if (buffer.size() + s.size() > buffer.capacity()) {
+            flush();
+        }
+        buffer.append(s);
+        return *this;
+    }
+
+    // Otherwise string literals would pick the bool overload
+    BufferedWriter& operator<<(const char* s) {
+        return *this << string_view(s);
+    }
+
+    BufferedWriter& operator<<(uint64_t n) {
+        char digits[20];
+        auto end = to_chars(begin(digits), std::end(digits), n).ptr;
+        return *this << string_view(digits, end - digits);
+    }
+
+    BufferedWriter& operator<<(bool b) {
+        return *this << (b ? string_view("true") : string_view("false"));
+    }
+
+    // As a JSON string, with the quotes
+    BufferedWriter& quoted(string_view s) {
+        *this << "\"";
+        size_t plain = 0;
+        for (size_t i = 0; i < s.size(); i++) {
+            unsigned char c = s[i];
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            *this << s.substr(plain, i - plain);
+            static const char* hex = "0123456789abcdef";
+            char escape[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+            *this << (c == '"' ? string_view("\\\"") : c == '\\' ? string_view("\\\\") : string_view(escape, 6));
+            plain = i + 1;
+        }
+        return *this << s.substr(plain) << "\"";
+    }
+
+    void flush() {
+        fwrite(buffer.data(), 1, buffer.size(), file);
+        fflush(file);
+        buffer.clear();
+    }
+
+private:
+    FILE* file;
+    string buffer;
+};
+
+#ifdef WDEPS_STATS
+// The spans kept since Stats::startTrace() as Chrome trace events, one track per thread
+void saveTrace(const fs::path& file) {
+    FILE* f = fopen(file.string().c_str(), "wb");
+    if (f == nullptr) {
+        throw runtime_error("Unable to write the trace to " + file.string());
+    }
+    {
+        BufferedWriter out(f);
+        // Trace times are in microseconds, the fraction keeps the short parse stages visible
+        auto micros = [&](uint64_t ns) {
+            char fraction[3] = { char('0' + ns / 100 % 10), char('0' + ns / 10 % 10), char('0' + ns % 10) };
+            out << ns / 1000 << "." << string_view(fraction, 3);
+        };
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (auto& track : Stats::tracks()) {
+            auto name = track->thread == 0 ? string("main") : "worker " + to_string(track->thread);
+            out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << uint64_t(track->thread) << ",\"args\":{\"name\":";
+            out.quoted(name) << "}}";
+            first = false;
+            for (auto& span : track->spans) {
+                out << ",\n{\"ph\":\"X\",\"cat\":\"wdeps\",\"name\":\"" << Stats::phaseName(span.phase) << "\",\"pid\":1,\"tid\":" << uint64_t(track->thread) << ",\"ts\":";
+                micros(span.startNs);
+                out << ",\"dur\":";
+                micros(span.durationNs);
+                if (!span.detail.empty()) {
+                    out << ",\"args\":{\"file\":";
+                    out.quoted(span.detail) << "}";
+                }
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+    }
+    bool failed = ferror(f) != 0;
+    if (fclose(f) != 0 || failed) {
+        throw runtime_error("Unable to write the trace to " + file.string());
+    }
+}
+#endif
+
+// One JSON object per line for every node reachable from the inputs and for every edge between them. Nodes are
+// numbered in breadth-first order from the inputs, and each node's line comes before the first edge
+// that refers to it.
+void writeNdjson(const vector<Dll*>& roots, BufferedWriter& out) {
+    unordered_map<const Dll*, uint64_t> ids;
+    deque<const Dll*> pending;
+    auto node = [&](const Dll& dll, bool input) {
+        auto id = ids.emplace(&dll, ids.size());
+        if (!id.second) {
+            return id.first->second;
+        }
+        static const char* locations[] = { "user", "system", "missing" };
+        out << "{\"type\":\"node\",\"id\":" << id.first->second << ",\"name\":";
+        out.quoted(dll.path.path.filename().string()) << ",\"path\":";
+        out.quoted(dll.path.path.string()) << ",\"location\":\"" << locations[dll.path.location] << "\"";
+        out << ",\"isValid\":" << dll.isValid << ",\"stripped\":" << dll.stripped << ",\"size\":";
+        if (auto size = dll.fileSize()) {
+            out << *size;
+        }else{
+            out << "null";
+        }
+        out << ",\"input\":" << input << "}\n";
+        pending.push_back(&dll);
+        return id.first->second;
+    };
+    for (auto* root : roots) {
+        node(*root, true);
+    }
+    while (!pending.empty()) {
+        auto* dll = pending.front();
+        pending.pop_front();
+        auto from = ids[dll];
+        for (auto& edge : dll->dependencies) {
+            auto to = node(*edge.dll, false);
+            out << "{\"type\":\"edge\",\"from\":" << from << ",\"to\":" << to << ",\"delayed\":" << edge.delayed << "}\n";
+        }
+    }
+}
 
-struct DllPath {
-    fs::path path;
-    enum { User, System, Missing } location;
+// A scanned graph saved to a file, so that the reports can be run on it again without the files. The file
+// is the header, followed by arrays of fixed-size records in the host's byte order: the nodes, the CSR
+// edge offsets (nodeCount + 1 of them, the edges of node i are edges[offsets[i]..offsets[i + 1])), the
+// edges, the indexes of the input nodes and finally the string table. Loading maps the file and reads the
+// records in place.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t edgeCount;
+    uint32_t rootCount;
+    uint64_t stringBytes;
+};
 
-    DllPath& fix() {
-        path = path.parent_path() / getFileNameWithCorrectCase(path.string());
-        return *this;
-    }
+struct SnapshotNode {
+    uint64_t size;
+    // Offset into the string table, and length
+    uint32_t path;
+    uint32_t pathLength;
+    uint8_t location;
+    uint8_t flags;
+    uint8_t padding[6];
 };
 
-DllPath getDllPath(const fs::path& appDirectory, const string& dllName) {
-    if (fs::exists(appDirectory / dllName)) {
-        return DllPath{ appDirectory / dllName, DllPath::User }.fix();
-    }
+const char snapshotMagic[8] = { 'W', 'D', 'E', 'P', 'S', 'N', 'A', 'P' };
+const uint32_t snapshotVersion = 1;
+enum : uint8_t { SnapshotValid = 1, SnapshotStripped = 2, SnapshotHasSize = 4 };
+// Set on an edge for a delay-loaded import, the rest is the index of the node
+const uint32_t snapshotDelayedEdge = 0x80000000;
 
-    if (fs::exists(systemDirectory() / dllName)) {
-        return DllPath{ systemDirectory() / dllName, DllPath::System }.fix();
+void saveSnapshot(const vector<Dll*>& roots, const fs::path& file) {
+    // Numbered breadth-first from the inputs, like the NDJSON output
+    unordered_map<const Dll*, uint32_t> ids;
+    vector<const Dll*> nodes;
+    auto add = [&](const Dll* dll) {
+        if (ids.emplace(dll, uint32_t(nodes.size())).second) {
+            nodes.push_back(dll);
+        }
+        return ids[dll];
+    };
+    for (auto* root : roots) {
+        add(root);
     }
-
-    if (fs::exists(windowsDirectory() / dllName)) {
-        return DllPath{ windowsDirectory() / dllName, DllPath::System }.fix();
+    vector<uint32_t> offsets{ 0 };
+    vector<uint32_t> edges;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        for (auto& edge : nodes[i]->dependencies) {
+            edges.push_back(add(edge.dll) | (edge.delayed ? snapshotDelayedEdge : 0));
+        }
+        offsets.push_back(uint32_t(edges.size()));
     }
 
-    for (auto& s : getPathEnv()) {
-        if (fs::exists(fs::path(s) / dllName)) {
-            return DllPath{ fs::path(s) / dllName, DllPath::User }.fix();
+    // Identical strings are stored once
+    string strings;
+    unordered_map<string, uint32_t> interned;
+    vector<SnapshotNode> records;
+    for (auto* dll : nodes) {
+        auto path = dll->path.path.string();
+        auto it = interned.emplace(path, uint32_t(strings.size()));
+        if (it.second) {
+            strings += path;
         }
+        SnapshotNode record{};
+        auto size = dll->fileSize();
+        record.size = size.value_or(0);
+        record.path = it.first->second;
+        record.pathLength = uint32_t(path.size());
+        record.location = uint8_t(dll->path.location);
+        record.flags = (dll->isValid ? SnapshotValid : 0) | (dll->stripped ? SnapshotStripped : 0) | (size ? SnapshotHasSize : 0);
+        records.push_back(record);
+    }
+    vector<uint32_t> rootIds;
+    for (auto* root : roots) {
+        rootIds.push_back(ids[root]);
     }
 
-    return { dllName, DllPath::Missing };
-}
+    SnapshotHeader header{};
+    copy(begin(snapshotMagic), end(snapshotMagic), header.magic);
+    header.version = snapshotVersion;
+    header.nodeCount = uint32_t(records.size());
+    header.edgeCount = uint32_t(edges.size());
+    header.rootCount = uint32_t(rootIds.size());
+    header.stringBytes = strings.size();
 
-struct Dll {
-    explicit Dll(DllPath path) : path(move(path)) { }
+    ofstream out(file.string(), ios::binary | ios::trunc);
+    auto write = [&](const void* data, size_t bytes) { out.write(static_cast<const char*>(data), bytes); };
+    write(&header, sizeof(header));
+    write(records.data(), records.size() * sizeof(SnapshotNode));
+    write(offsets.data(), offsets.size() * sizeof(uint32_t));
+    write(edges.data(), edges.size() * sizeof(uint32_t));
+    write(rootIds.data(), rootIds.size() * sizeof(uint32_t));
+    write(strings.data(), strings.size());
+    if (!out) {
+        throw runtime_error("Unable to write the snapshot " + file.string());
+    }
+}
 
-    DllPath path;
-    // This gets mutated during fillDependencies
-    bool isValid = true;
-    bool stripped = false;
-    vector<Dll*> dependencies;
+// Rebuilds the graph from a snapshot into nodes and returns the inputs. The sizes come from the
+// snapshot, so the reports that only need the graph don't touch the files.
+vector<Dll*> loadSnapshot(const fs::path& file, vector<unique_ptr<Dll>>& nodes) {
+    namespace ipc = boost::interprocess;
+    auto invalid = [&] { return runtime_error("Invalid snapshot " + file.string()); };
+    ipc::file_mapping mapping;
+    ipc::mapped_region region;
+    try {
+        mapping = ipc::file_mapping(file.string().c_str(), ipc::read_only);
+        region = ipc::mapped_region(mapping, ipc::read_only);
+    }catch(ipc::interprocess_exception& e) {
+        throw runtime_error("Unable to read the snapshot " + file.string() + ": " + e.what());
+    }
+    auto* base = static_cast<const char*>(region.get_address());
+    uint64_t length = region.get_size();
+    STATS_ADD(BytesMapped, length);
 
-    bool isSystem() const { return path.location == DllPath::System; }
+    if (length < sizeof(SnapshotHeader)) {
+        throw invalid();
+    }
+    auto& header = *reinterpret_cast<const SnapshotHeader*>(base);
+    if (!equal(begin(snapshotMagic), end(snapshotMagic), header.magic) || header.version != snapshotVersion) {
+        throw invalid();
+    }
+    uint64_t nodesAt = sizeof(SnapshotHeader);
+    uint64_t offsetsAt = nodesAt + uint64_t(header.nodeCount) * sizeof(SnapshotNode);
+    uint64_t edgesAt = offsetsAt + (uint64_t(header.nodeCount) + 1) * sizeof(uint32_t);
+    uint64_t rootsAt = edgesAt + uint64_t(header.edgeCount) * sizeof(uint32_t);
+    uint64_t stringsAt = rootsAt + uint64_t(header.rootCount) * sizeof(uint32_t);
+    if (stringsAt + header.stringBytes != length) {
+        throw invalid();
+    }
+    auto* records = reinterpret_cast<const SnapshotNode*>(base + nodesAt);
+    auto* offsets = reinterpret_cast<const uint32_t*>(base + offsetsAt);
+    auto* edges = reinterpret_cast<const uint32_t*>(base + edgesAt);
+    auto* rootIds = reinterpret_cast<const uint32_t*>(base + rootsAt);
+    auto* strings = base + stringsAt;
 
-    void fillDependencies(map<string, unique_ptr<Dll>>& globalMap, bool recurseIntoSystem = false) {
-        if (path.location == DllPath::Missing || (path.location == DllPath::System && !recurseIntoSystem)) {
-            return;
+    nodes.clear();
+    nodes.reserve(header.nodeCount);
+    for (uint32_t i = 0; i < header.nodeCount; i++) {
+        auto& record = records[i];
+        if (uint64_t(record.path) + record.pathLength > header.stringBytes || record.location > DllPath::Missing) {
+            throw invalid();
         }
-        auto directory = path.path.parent_path();
-        auto parsed = ParsePEFromFile(path.path.string().c_str());
-        if (parsed == nullptr) {
-            isValid = false;
-            return;
+        auto location = static_cast<decltype(DllPath::location)>(record.location);
+        auto& dll = *nodes.emplace_back(make_unique<Dll>(DllPath{ string(strings + record.path, record.pathLength), location }));
+        dll.isValid = (record.flags & SnapshotValid) != 0;
+        dll.stripped = (record.flags & SnapshotStripped) != 0;
+        dll.sizeKnown = true;
+        if (record.flags & SnapshotHasSize) {
+            dll.size = record.size;
         }
-
-        set<string> modules;
-        IterImpVAString(parsed, [](void *N, VA impAddr, string &modName, string &symName) {
-            auto modulesPtr = reinterpret_cast<set<string>*>(N);
-            modulesPtr->insert(modName);
-            return 0;
-        }, &modules);
-        auto& c = parsed->peHeader.nt.FileHeader.Characteristics;
-        if ((c & IMAGE_FILE_DEBUG_STRIPPED) && (c & IMAGE_FILE_LINE_NUMS_STRIPPED) && (c & IMAGE_FILE_LOCAL_SYMS_STRIPPED)) {
-            stripped = true;
+    }
+    for (uint32_t i = 0; i < header.nodeCount; i++) {
+        if (offsets[i] > offsets[i + 1] || offsets[i + 1] > header.edgeCount) {
+            throw invalid();
         }
-        for (auto& s : modules) {
-            if (globalMap.count(s)) {
-                dependencies.push_back(globalMap[s].get());
-                continue;
+        for (uint32_t e = offsets[i]; e < offsets[i + 1]; e++) {
+            uint32_t target = edges[e] & ~snapshotDelayedEdge;
+            if (target >= header.nodeCount) {
+                throw invalid();
             }
-            auto dllPath = getDllPath(directory, s);
-            auto& result = globalMap.emplace(s, make_unique<Dll>(move(dllPath))).first->second;
-            dependencies.push_back(result.get());
-            result->fillDependencies(globalMap, recurseIntoSystem);
-        }
-    }
-
-    string toString(bool showPath = true) const {
-        switch (path.location) {
-            case DllPath::Missing: return path.path.string() + " (MISSING)";
-            case DllPath::User: return path.path.filename().string() + (isValid ? "" : " (INVALID!)") + (showPath ? " (" + path.path.string() + ")" : "");
-            case DllPath::System: return path.path.filename().string() + "(SYSTEM)" + (showPath ? " (" + path.path.string() + ")" : "");
+            nodes[i]->dependencies.push_back({ nodes[target].get(), (edges[e] & snapshotDelayedEdge) != 0, {} });
         }
     }
-};
-
-using uint = unsigned int;
-void doWalkDependencies(
-    const Dll& dll,
-    set<const Dll*>& visited,
-    const function<void(const Dll&, bool wasVisited, uint level)>& action,
-    const function<bool(const Dll&, bool wasVisited, uint level)>& recurseFilter,
-    uint level
-) {
-    visited.insert(&dll);
-    for (auto* dependency : dll.dependencies) {
-        bool wasVisited = visited.count(dependency) > 0;
-        action(*dependency, wasVisited, level);
-        if (!wasVisited && (!recurseFilter || recurseFilter(*dependency, wasVisited, level))) {
-            doWalkDependencies(*dependency, visited, action, recurseFilter, level + 1);
+    vector<Dll*> roots;
+    for (uint32_t i = 0; i < header.rootCount; i++) {
+        if (rootIds[i] >= header.nodeCount) {
+            throw invalid();
         }
+        roots.push_back(nodes[rootIds[i]].get());
     }
+    return roots;
 }
 
-void walkDependencies(
-    const Dll& dll,
-    const function<void(const Dll&, bool wasVisited, uint level)>& action,
-    bool visitRoot = false,
-    const function<bool(const Dll&, bool wasVisited, uint level)>& recurseFilter = {}
-) {
-    if (visitRoot) {
-        action(dll, false, 0);
+// A node that depends on all of the inputs, for the reports that cover all of them at once
+Dll aggregateOf(const vector<Dll*>& roots) {
+    Dll aggregate({ "", DllPath::User });
+    for (auto* root : roots) {
+        aggregate.dependencies.push_back({ root, false, {} });
     }
-    set<const Dll*> visitedSet;
-    doWalkDependencies(dll, visitedSet, action, recurseFilter, 1);
+    return aggregate;
 }
 
-void dumpDependenciesTree(
-    const Dll& dll,
-    bool visitRoot = true,
-    bool showPath = true,
-    const function<bool(const Dll&, bool wasDumped, uint level)>& printFilter = {},
-    const function<bool(const Dll&, bool wasDumped, uint level)>& recurseFilter = {}
-) {
-    walkDependencies(dll, [&](const Dll& dependency, bool wasVisited, uint level) {
-        string indent(level * 4, ' ');
-        if (!printFilter || printFilter(dependency, wasVisited, level)) {
-            cout << indent << dependency.toString(showPath) << (wasVisited ? " (+)" : "") << endl;
-        }
-    }, visitRoot, recurseFilter);
-}
+// How copyFile copied a file
+enum class CopyMethod { Reflink, CopyFileRange, Buffered, Portable };
 
-void dumpDependenciesFlat(
-    const Dll& dll,
-    bool visitRoot = true,
-    const function<bool(const Dll&, bool wasDumped, uint level)>& printFilter = {},
-    const function<bool(const Dll&, bool wasDumped, uint level)>& recurseFilter = {}
-) {
-    walkDependencies(dll, [&](const Dll& dependency, bool wasVisited, uint level) {
-        string indent = (level > 0 && visitRoot ? "    " : "");
-        if (!printFilter || printFilter(dependency, wasVisited, level)) {
-            cout << indent << dependency.toString() << (wasVisited ? " (+ more, see above)" : "") << endl;
-        }
-    }, visitRoot, recurseFilter);
-}
+#ifdef __linux__
+// Closes the descriptor when it goes out of scope
+struct FileDescriptor {
+    int fd;
 
-void dumpFlatNonSystemDependencies(const Dll& dll) {
-    dumpDependenciesFlat(
-        dll,
-        true,
-        [](const Dll& dep, bool dumped, uint level) { return !dumped && dep.path.location != DllPath::System; }
-    );
-}
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
 
-void dumpTreeNonSystemDependencies(const Dll& dll) {
-    dumpDependenciesFlat(
-        dll,
-        true,
-        [](const Dll& dep, bool dumped, uint level) { return !dumped && dep.path.location != DllPath::System; }
-    );
-}
+    ~FileDescriptor() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+};
 
-string formatFileSize(size_t size) {
-    stringstream ss;
-    if (size < 1024) { ss << size << "B"; }
-    else if (size < 1024*1024) { ss << setprecision(2) << fixed << size/1024.0 << "kB"; }
-    else ss << setprecision(2) << fixed << size/(1024.0*1024.0) << "MB";
-    return ss.str();
-}
+// Shares the extents of the source when the filesystem can (FICLONE on btrfs, XFS, ...), copies in the
+// kernel with copy_file_range when it can't, and with read/write when neither works
+CopyMethod copyFile(const fs::path& source, const fs::path& target, bool overwrite, uint64_t& bytes) {
+    auto fail = [&](const char* what) {
+        return runtime_error("Unable to copy " + source.string() + " to " + target.string() + ": " + what + ": " + strerror(errno));
+    };
+    FileDescriptor in{ open(source.c_str(), O_RDONLY | O_CLOEXEC) };
+    struct stat status;
+    if (in.fd < 0 || fstat(in.fd, &status) != 0) {
+        throw fail("open");
+    }
+    FileDescriptor out{ open(target.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (overwrite ? O_TRUNC : O_EXCL), status.st_mode & 07777) };
+    if (out.fd < 0) {
+        throw fail("create");
+    }
+    bytes = status.st_size;
+    // Doesn't leave a partial copy behind
+    auto abandon = [&](const char* what) {
+        auto error = fail(what);
+        unlink(target.c_str());
+        return error;
+    };
 
-void printSizeInfo(const Dll& dll, bool includeSystem = false, bool showPath = false) {
-    size_t total = 0;
-    bool anyUnstripped = false;
-    walkDependencies(dll, [&](const Dll& dependency, bool wasVisited, uint level) {
-        if ((dependency.isSystem() && !includeSystem) || wasVisited) { return; }
+#ifdef FICLONE
+    if (ioctl(out.fd, FICLONE, in.fd) == 0) {
+        return CopyMethod::Reflink;
+    }
+#endif
 
-        optional<size_t> fileSize;
-        boost::system::error_code fileError;
-        if (dependency.path.location != DllPath::Missing) {
-            auto size = fs::file_size(dependency.path.path, fileError);
-            if (!fileError) {
-                fileSize = size;
-                total += size;
-            }
+    uint64_t copied = 0;
+    while (copied < bytes) {
+        auto n = copy_file_range(in.fd, nullptr, out.fd, nullptr, bytes - copied, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        // Not supported by the kernel or between these filesystems, nothing was written yet
+        if (n < 0 && copied == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+            break;
+        }
+        if (n < 0) {
+            throw abandon("copy_file_range");
+        }
+        if (n == 0) {
+            // Either the file got shorter while it was copied, or a filesystem (procfs, some FUSE and NFS
+            // ones) that reports no data through copy_file_range, read() tells them apart. Both offsets
+            // moved by what was copied so far, so read/write carries on from there.
+            break;
         }
+        copied += n;
+    }
+    if (copied == bytes) {
+        return CopyMethod::CopyFileRange;
+    }
 
-        string indent = (level > 0 ? "    " : "");
-        string size = fileSize ? formatFileSize(*fileSize) : "ERROR";
-        if (!dependency.stripped) { anyUnstripped = true; }
-        cout <<
-            indent <<
-            dependency.path.path.filename().string() <<
-            " (" << size << ")" <<
-            (dependency.isSystem() ? " (SYSTEM)" : "") <<
-            ((dependency.stripped || dependency.isSystem()) ? "" : "*") <<
-            (showPath ? " (" + dependency.path.path.string() + ")" : "") <<
-            endl;
-    }, true);
-    cout << endl;
-    cout << "Total: " << formatFileSize(total) << endl;
-    if (anyUnstripped) {
-        cout << "Files marked with * can be further stripped." << endl;
+    vector<char> buffer(1024 * 1024);
+    bytes = copied;
+    while (true) {
+        auto n = read(in.fd, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw abandon("read");
+        }
+        if (n == 0) {
+            return CopyMethod::Buffered;
+        }
+        for (ssize_t written = 0; written < n;) {
+            auto w = write(out.fd, buffer.data() + written, n - written);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w < 0) {
+                throw abandon("write");
+            }
+            written += w;
+        }
+        bytes += n;
     }
 }
+#else
+CopyMethod copyFile(const fs::path& source, const fs::path& target, bool overwrite, uint64_t& bytes) {
+    fs::copy_file(source, target, overwrite ? fs::copy_option::overwrite_if_exists : fs::copy_option::none);
+    bytes = fs::file_size(source);
+    return CopyMethod::Portable;
+}
+#endif
 
-void copyTo(const Dll& dll, const fs::path& target, bool overwrite = false, bool includeRoot = false) {
+// Copies the non-system dependencies on `jobs` threads, reporting every file that can't be copied to
+// stderr and a summary of the throughput to `summary`
+void copyTo(const vector<const Dll*>& roots, const fs::path& target, bool overwrite, bool includeRoots, unsigned jobs, ostream& summary) {
     try {
         if (!target.filename_is_dot() && !target.filename_is_dot_dot()) {
             fs::create_directories(target);
@@ -281,21 +2171,176 @@ void copyTo(const Dll& dll, const fs::path& target, bool overwrite = false, bool
         cerr << e.what() << endl;
         return;
     }
-    walkDependencies(dll, [&](const Dll& dependency, bool wasVisited, uint level) {
-        if (dependency.path.location != DllPath::User || wasVisited) { return; }
-        try {
-            if (fs::path(dependency.path.path).parent_path() == fs::path(target)) {
+
+    struct CopyJob {
+        fs::path source;
+        fs::path target;
+        uint64_t bytes = 0;
+        optional<CopyMethod> method;
+        string error;
+    };
+    // Dependencies shared by several inputs are copied only once, and only one file is copied to every name
+    vector<CopyJob> copies;
+    set<const Dll*> copied;
+    map<string, fs::path> sources;
+    for (auto* root : roots) {
+        walkDependencies(*root, [&](const Dll& dependency, bool wasVisited, uint level) {
+            if (dependency.path.location != DllPath::User || wasVisited || !copied.insert(&dependency).second) { return; }
+            if (dependency.path.path.parent_path() == target) {
                 return;
             }
-            fs::copy_file(
-                dependency.path.path,
-                target / dependency.path.path.filename(),
-                overwrite ? fs::copy_option::overwrite_if_exists : fs::copy_option::none
-            );
-        }catch(exception& e) {
-            cerr << e.what() << endl;
+            CopyJob job{ dependency.path.path, target / dependency.path.path.filename() };
+            auto first = sources.emplace(foldCase(job.target.filename().string()), job.source);
+            if (!first.second) {
+                job.error = "Not copying " + job.source.string() + ", " + first.first->second.string() + " is copied to the same name";
+            }
+            copies.push_back(move(job));
+        }, includeRoots);
+    }
+
+    auto start = chrono::steady_clock::now();
+    {
+        WorkStealingPool pool(max(1u, min(jobs, unsigned(copies.size()))));
+        for (auto& job : copies) {
+            if (!job.error.empty()) {
+                continue;
+            }
+            pool.submit([&job, overwrite] {
+                STATS_SCOPE_FOR(Copy, job.target.filename().string());
+                try {
+                    job.method = copyFile(job.source, job.target, overwrite, job.bytes);
+                }catch(exception& e) {
+                    job.error = e.what();
+                }
+            });
+        }
+        pool.wait();
+    }
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+
+    size_t files = 0, failed = 0;
+    uint64_t bytes = 0;
+    map<CopyMethod, size_t> methods;
+    for (auto& job : copies) {
+        if (!job.error.empty()) {
+            cerr << job.error << endl;
+            failed++;
+            continue;
+        }
+        files++;
+        bytes += job.bytes;
+        methods[*job.method]++;
+    }
+    double seconds = max(elapsed.count() / 1e9, 1e-9);
+    summary << "Copied " << files << " files (" << formatFileSize(bytes) << ") in " << formatDuration(elapsed) << ", "
+        << formatFileSize(size_t(bytes / seconds)) << "/s";
+#ifdef __linux__
+    summary << " (" << methods[CopyMethod::Reflink] << " reflinked, " << methods[CopyMethod::CopyFileRange] << " with copy_file_range, "
+        << methods[CopyMethod::Buffered] << " buffered)";
+#endif
+    if (failed > 0) {
+        summary << ", " << failed << " failed";
+    }
+    summary << '\n';
+}
+
+#ifdef __linux__
+// Reports the files that get written, moved, or deleted in a set of directories, using inotify
+class DirectoryWatcher {
+public:
+    DirectoryWatcher() : fd(inotify_init1(IN_CLOEXEC)) {
+        if (fd < 0) {
+            throw runtime_error(string("Unable to watch for changes: ") + strerror(errno));
+        }
+    }
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    ~DirectoryWatcher() {
+        close(fd);
+    }
+
+    // Directories that don't exist are skipped, the same directory can be watched under several spellings
+    void watch(const fs::path& directory) {
+        auto path = directory.empty() ? fs::path(".") : directory;
+        if (!watched.insert(path.string()).second) {
+            return;
+        }
+        int wd = inotify_add_watch(fd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+        if (wd >= 0) {
+            directories[wd].push_back(directory);
+        }
+    }
+
+    // Blocks until something changes, then keeps collecting changes until there were none for `quiet`,
+    // since writing a file (a linker, a copy) usually takes more than one event
+    vector<fs::path> wait(chrono::milliseconds quiet) {
+        vector<fs::path> changed;
+        set<string> seen;
+        int timeout = -1;
+        while (true) {
+            pollfd request{ fd, POLLIN, 0 };
+            int ready = poll(&request, 1, timeout);
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready < 0) {
+                throw runtime_error(string("Unable to watch for changes: ") + strerror(errno));
+            }
+            if (ready == 0) {
+                return changed;
+            }
+            alignas(inotify_event) char buffer[64 * 1024];
+            auto length = read(fd, buffer, sizeof(buffer));
+            for (ssize_t offset = 0; offset < length;) {
+                auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+                auto it = directories.find(event->wd);
+                if (it == directories.end() || event->len == 0) {
+                    continue;
+                }
+                for (auto& directory : it->second) {
+                    auto file = directory / event->name;
+                    if (seen.insert(file.string()).second) {
+                        changed.push_back(file);
+                    }
+                }
+            }
+            timeout = int(quiet.count());
+        }
+    }
+
+private:
+    int fd;
+    set<string> watched;
+    unordered_map<int, vector<fs::path>> directories;
+};
+#endif
+
+// Input files, with "@file" entries replaced by the list of files in that file (one per line)
+vector<string> expandInputs(const vector<string>& inputs) {
+    vector<string> result;
+    for (auto& input : inputs) {
+        if (input.empty() || input[0] != '@') {
+            result.push_back(input);
+            continue;
+        }
+        ifstream list(input.substr(1));
+        if (!list) {
+            throw runtime_error("Unable to read the input list " + input.substr(1));
+        }
+        string line;
+        while (getline(list, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty() && line[0] != '#') {
+                result.push_back(line);
+            }
         }
-    }, includeRoot);
+    }
+    return result;
 }
 
 int main(int argc, char** argv) {
@@ -303,14 +2348,35 @@ int main(int argc, char** argv) {
     description.add_options()
         ("copy", po::value<string>()->value_name("dir"), "If specified, copy all dependencies to the specified directory.")
         ("force", po::bool_switch(), "When used with --copy, overwrite existing files.")
-        ("all", po::bool_switch(), "When used with --copy, also include the input file.")
+        ("all", po::bool_switch(), "When used with --copy, also include the input files.")
         ("tree", po::bool_switch(), "Display the dependencies as a tree (each dependency will only be expanded once).")
         ("system", po::bool_switch(), "Include system dependencies, doesn't affect `--copy`, system dependencies are not recursed into.")
         ("path", po::bool_switch(), "Include the full path to the dependencies in the list.")
+        ("rebase", po::bool_switch(), "Instead of the list of dependencies, show the non-system DLLs whose preferred image base collides with one loaded before them, ranked by the number of relocations the loader has to apply to move them.")
+        ("usage", po::bool_switch(), "Instead of the list of dependencies, show how many symbols each file imports from each of its dependencies, and mark the ones used for only a few of them.")
+        ("few-symbols", po::value<unsigned>()->default_value(3)->value_name("N"), "When used with --usage, mark the dependencies used for at most N symbols.")
+        ("unresolved", po::bool_switch(), "Instead of the list of dependencies, show the imported symbols (and ordinals) that the DLL they are imported from doesn't export.")
+        ("probes", po::bool_switch(), "Instead of the list of dependencies, show every path probed while looking for each module, whether the module was there and how long it took, then rank the search directories (PATH entries included) by the time spent probing them.")
+        ("format", po::value<string>()->default_value("text")->value_name("fmt"), "Output format, \"text\" for the reports or \"ndjson\" for one JSON record per dependency and per import edge, with all the dependencies included.")
+        ("save-snapshot", po::value<string>()->value_name("file"), "Save the dependency graph to the specified file, for use with --load-snapshot.")
+        ("load-snapshot", po::value<string>()->value_name("file"), "Report on a graph saved with --save-snapshot instead of scanning the inputs, without reading any of the files (except for --copy).")
+        ("startup", po::bool_switch(), "Only show the dependencies that are loaded when the process starts, leaving out the delay-loaded ones. Doesn't affect `--copy`.")
+        ("watch", po::bool_switch(), "Keep running, and report again whenever an input or one of its dependencies changes, appears or is deleted (only on Linux).")
+#ifdef WDEPS_STATS
+        ("trace", po::value<string>()->value_name("file"), "Write a Chrome trace (JSON, for Perfetto or chrome://tracing) of the scan and the reports to the file, with spans for every module lookup, file mapping, parse stage and report pass, on one track per thread.")
+        ("stats", po::bool_switch(), "Print the time spent in each phase of the scan and the report (path lookups, mapping, every parse stage, the graph walks, the output), and counters of the work done, to stderr.")
+#endif
+        ("jobs", po::value<unsigned>()->default_value(1)->value_name("N"), "Resolve and parse dependencies, and copy them with --copy, on N threads (0 = one per CPU core), the output is the same as with 1.")
+        ("sysroot", po::value<string>()->value_name("dir"), "Look for system DLLs in the Windows installation under the specified directory (e.g. a Wine prefix's drive_c) instead of the host's one.")
+        ("search-path", po::value<vector<string>>()->value_name("dirs"), "Semicolon-separated directories to search instead of PATH, can be given multiple times. Required to find anything outside the application directory on hosts other than Windows.")
+        ("cache-dir", po::value<string>()->value_name("dir"), "Keep the parsed import lists in the specified directory, so that unchanged files aren't parsed again on the next run.")
+        ("cache-size", po::value<unsigned>()->default_value(64)->value_name("MB"), "When used with --cache-dir, the size above which the least recently used entries are evicted.")
+        ("pool-files", po::value<unsigned>()->default_value(64)->value_name("N"), "Keep at most N parsed files mapped for reuse by later passes.")
+        ("pool-mb", po::value<unsigned>()->default_value(256)->value_name("MB"), "Keep at most this many megabytes of parsed files mapped for reuse by later passes.")
         ("help", "Print this help message.")
-        ("input", po::value<vector<string>>()->value_name("file"), "The exe/dll file for which to show dependencies.");
+        ("input", po::value<vector<string>>()->value_name("file"), "The exe/dll files for which to show dependencies, \"@list\" reads more of them from a file with one path per line.");
     po::positional_options_description pos;
-    pos.add("input", 1);
+    pos.add("input", -1);
 
     po::variables_map varMap;
     try {
@@ -321,29 +2387,263 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    if (varMap.count("help") || varMap.count("input") == 0) {
-        cout << "Usage: wdeps [options] <input>\n" << endl;
-        cout << description << endl;
+    if (varMap.count("help") || (varMap.count("input") == 0 && varMap.count("load-snapshot") == 0)) {
+        cout << "Usage: wdeps [options] <input>...\n\n";
+        cout << description << '\n';
         return 0;
     }
 
     bool includeSystem = varMap["system"].as<bool>();
     bool showPath = varMap["path"].as<bool>();
+    bool startupOnly = varMap["startup"].as<bool>();
+    auto format = varMap["format"].as<string>();
+    if (format != "text" && format != "ndjson") {
+        cerr << "Unknown format " << format << endl;
+        return 1;
+    }
 
-    map<string, unique_ptr<Dll>> globalMap;
-    Dll exe({ varMap["input"].as<vector<string>>().at(0), DllPath::User });
-    exe.fillDependencies(globalMap);
-    if (varMap["tree"].as<bool>()) {
-        dumpDependenciesTree(exe, true, showPath, [includeSystem](const Dll& dep, bool wasDumped, uint level) {
-            return includeSystem || !dep.isSystem();
-        });
+#ifdef WDEPS_STATS
+    bool stats = varMap["stats"].as<bool>();
+    if (stats) {
+        Stats::enable();
+    }
+    if (varMap.count("trace")) {
+        Stats::startTrace();
+    }
+#endif
+
+    unsigned jobs = varMap["jobs"].as<unsigned>();
+    if (jobs == 0) {
+        jobs = max(1u, thread::hardware_concurrency());
+    }
+
+    optional<ImportCache> cache;
+    if (varMap.count("cache-dir")) {
+        try {
+            cache.emplace(varMap["cache-dir"].as<string>(), uintmax_t(varMap["cache-size"].as<unsigned>()) * 1024 * 1024);
+        }catch(exception& e) {
+            cerr << e.what() << endl;
+        }
+    }
+
+    map<string, unique_ptr<Dll>, less<>> globalMap;
+    unique_ptr<DllSearchPath> searchPath;
+    vector<string> pathList;
+    if (varMap.count("search-path")) {
+        for (auto& list : varMap["search-path"].as<vector<string>>()) {
+            auto parts = splitPathList(list);
+            pathList.insert(pathList.end(), parts.begin(), parts.end());
+        }
+    }
+    if (varMap.count("sysroot")) {
+        searchPath = make_unique<DllSearchPath>(varMap["sysroot"].as<string>(), pathList);
+    }else if (varMap.count("search-path")) {
+        searchPath = make_unique<DllSearchPath>(pathList);
+    }else{
+        searchPath = make_unique<DllSearchPath>();
+    }
+    MappingPool mappings(varMap["pool-files"].as<unsigned>(), uint64_t(varMap["pool-mb"].as<unsigned>()) * 1024 * 1024);
+    bool usage = varMap["usage"].as<bool>();
+    bool unresolved = varMap["unresolved"].as<bool>();
+    bool probes = varMap["probes"].as<bool>();
+    if (probes) {
+        searchPath->recordProbes();
+    }
+    Scanner scanner(*searchPath, mappings, jobs, cache ? &*cache : nullptr, usage || unresolved);
+    bool watch = varMap["watch"].as<bool>();
+#ifndef __linux__
+    if (watch) {
+        cerr << "--watch is only supported on Linux" << endl;
+        return 1;
+    }
+#endif
+    vector<unique_ptr<Dll>> inputs;
+    vector<unique_ptr<Dll>> snapshotNodes;
+    vector<DllPath> inputPaths;
+    vector<Dll*> roots;
+    if (varMap.count("load-snapshot")) {
+        if (usage || unresolved || probes || varMap["rebase"].as<bool>() || watch) {
+            cerr << "--usage, --unresolved, --probes, --rebase and --watch read the files, so they can't be used with --load-snapshot" << endl;
+            return 1;
+        }
+        try {
+            roots = loadSnapshot(varMap["load-snapshot"].as<string>(), snapshotNodes);
+        }catch(exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
     }else{
-        printSizeInfo(exe, includeSystem, showPath);
+        try {
+            for (auto& input : expandInputs(varMap["input"].as<vector<string>>())) {
+                inputPaths.push_back(DllPath{ input, DllPath::User });
+            }
+        }catch(exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+    }
+
+    // Builds the graph from scratch, only what the scanner doesn't remember yet is looked up and parsed
+    auto scan = [&] {
+        STATS_SCOPE(BuildGraph);
+        globalMap.clear();
+        inputs.clear();
+        roots.clear();
+        for (auto& input : inputPaths) {
+            inputs.push_back(make_unique<Dll>(input));
+        }
+        scanner.prefetch(inputPaths, false);
+        // All inputs share globalMap, so every dependency is parsed only once
+        for (auto& input : inputs) {
+            input->fillDependencies(globalMap, scanner);
+        }
+
+        // An input that is also a dependency of another one is reported as that same node
+        for (auto& input : inputs) {
+            auto name = input->path.path.filename().string();
+            transform(name.begin(), name.end(), name.begin(), ::toupper);
+            auto it = globalMap.find(name);
+            bool shared = it != globalMap.end() && it->second->path.location == DllPath::User && scanner.sameFile(it->second->path.path, input->path.path);
+            roots.push_back(shared ? it->second.get() : input.get());
+        }
+    };
+
+    auto report = [&] {
+        STATS_SCOPE(Output);
+        if (varMap.count("save-snapshot")) {
+            try {
+                saveSnapshot(roots, varMap["save-snapshot"].as<string>());
+            }catch(exception& e) {
+                cerr << e.what() << endl;
+            }
+        }
+
+        if (format == "ndjson") {
+            STATS_SCOPE_FOR(Report, "ndjson");
+            BufferedWriter out(stdout);
+            writeNdjson(roots, out);
+        }
+        if (probes && format == "text") {
+            STATS_SCOPE_FOR(Report, "probes");
+            printProbeInfo(*searchPath);
+        }
+        for (size_t i = 0; i < roots.size() && format == "text" && !probes; i++) {
+            auto* root = roots[i];
+            STATS_SCOPE_FOR(Report, root->path.path.filename().string());
+            if (i > 0) {
+                cout << '\n';
+            }
+            if (unresolved) {
+                printUnresolvedInfo(*root, mappings, scanner, includeSystem);
+            }else if (usage) {
+                printUsageInfo(*root, includeSystem, varMap["few-symbols"].as<unsigned>());
+            }else if (varMap["rebase"].as<bool>()) {
+                printRebaseInfo(*root, mappings, showPath);
+            }else if (varMap["tree"].as<bool>()) {
+                dumpDependenciesTree(*root, true, showPath, [includeSystem](const Dll& dep, bool wasDumped, uint level) {
+                    return includeSystem || !dep.isSystem();
+                }, {}, startupOnly);
+            }else{
+                printSizeInfo(*root, includeSystem, showPath, true, startupOnly);
+            }
+        }
+
+        auto aggregate = aggregateOf(roots);
+        // Each input is a separate process with its own address space, so collisions aren't aggregated, and the
+        // usage and unresolved reports are per importing file, so they already cover every file once per input
+        if (roots.size() > 1 && format == "text" && !varMap["rebase"].as<bool>() && !usage && !unresolved && !probes) {
+            cout << "\nAll " << roots.size() << " inputs:\n";
+            printSizeInfo(aggregate, includeSystem, showPath, false, startupOnly);
+        }
+
+        if (varMap.count("copy")) {
+            // Keeps the ndjson on stdout parseable
+            auto& summary = format == "text" ? cout : cerr;
+            copyTo(vector<const Dll*>(roots.begin(), roots.end()), varMap["copy"].as<string>(), varMap["force"].as<bool>(), varMap["all"].as<bool>(), jobs, summary);
+        }
+
+        if (cache) {
+            cache->evict();
+        }
+    };
+
+    // The totals and the trace since the last call, after every report in watch mode
+    auto printStats = [&] {
+#ifdef WDEPS_STATS
+        if (stats) {
+            cerr << '\n';
+            Stats::print(cerr);
+            Stats::reset();
+        }
+        if (varMap.count("trace")) {
+            try {
+                saveTrace(varMap["trace"].as<string>());
+            }catch(exception& e) {
+                cerr << e.what() << endl;
+            }
+            Stats::restartTrace();
+        }
+#endif
+    };
+
+    if (!varMap.count("load-snapshot")) {
+        scan();
     }
+    report();
+    printStats();
 
-    if (varMap.count("copy")) {
-        copyTo(exe, varMap["copy"].as<string>(), varMap["force"].as<bool>(), varMap["all"].as<bool>());
+#ifdef __linux__
+    if (watch) {
+        try {
+            DirectoryWatcher watcher;
+            for (auto& directory : searchPath->directories()) {
+                watcher.watch(directory);
+            }
+            while (true) {
+                // Only a change to a file with the name of an input or of a dependency can change the graph, the
+                // directories of the ones found so far are watched for them (missing ones can only turn up there)
+                set<string> names;
+                for (auto& input : inputs) {
+                    names.insert(foldCase(input->path.path.filename().string()));
+                    watcher.watch(input->path.path.parent_path());
+                }
+                for (auto& entry : globalMap) {
+                    names.insert(foldCase(entry.second->path.path.filename().string()));
+                    if (entry.second->path.location != DllPath::Missing) {
+                        watcher.watch(entry.second->path.path.parent_path());
+                    }
+                }
+
+                cout.flush();
+                auto changed = watcher.wait(chrono::milliseconds(100));
+                changed.erase(remove_if(changed.begin(), changed.end(), [&](const fs::path& file) {
+                    return names.count(foldCase(file.filename().string())) == 0;
+                }), changed.end());
+                if (changed.empty()) {
+                    continue;
+                }
+
+                auto start = chrono::steady_clock::now();
+                for (auto& file : changed) {
+                    searchPath->forget(file.parent_path());
+                    scanner.forget(file);
+                }
+                mappings.clear();
+                if (format == "text") {
+                    cout << '\n';
+                }
+                scan();
+                report();
+                printStats();
+                auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+                cerr << changed.size() << " changed file(s), " << changed.front().filename().string() << (changed.size() > 1 ? ", ..." : "") << ", reported again in " << elapsed.count() << " ms" << endl;
+            }
+        }catch(exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
     }
+#endif
 
     return 0;
 }
\ No newline at end of file